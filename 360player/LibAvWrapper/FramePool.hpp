@@ -0,0 +1,73 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fixed set of output frames that are handed to the decoding thread and given
+	back once displayed, so frames and their pictures are allocated once
+	instead of for every frame. All frames are created up front and the free
+	frames are kept in a FrameQueue from the render thread (Release) back to
+	the decoding thread (Acquire), so giving a frame back takes no lock and
+	never waits. Acquire polls while every frame is in use.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "FrameQueue.hpp"
+
+namespace IMT {
+namespace LibAv {
+
+template <class T>
+class FramePool
+{
+public:
+	FramePool(size_t capacity) : free(std::max<size_t>(1, capacity)), stopped(false)
+	{
+		// the queue holds every frame, so Release never finds it full
+		for (size_t i = 0; i < free.Capacity(); i++)
+			free.Push(std::make_shared<T>());
+	}
+
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	// Takes a free frame, waits until one is given back if there is none.
+	// Returns nullptr once the pool is stopped. [decoding thread]
+	std::shared_ptr<T> Acquire(void)
+	{
+		std::shared_ptr<T> frame;
+		while (!stopped.load(std::memory_order_relaxed))
+		{
+			if (free.Pop(frame))
+				return frame;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return nullptr;
+	}
+
+	// Gives back a frame taken by Acquire, does nothing for nullptr [render thread]
+	void Release(std::shared_ptr<T>&& frame)
+	{
+		if (frame == nullptr)
+			return;
+		free.Push(std::move(frame));
+	}
+
+	// fails a waiting Acquire [thread safe]
+	void Stop(void)
+	{
+		stopped.store(true, std::memory_order_relaxed);
+	}
+
+private:
+	FrameQueue<T> free;
+	std::atomic<bool> stopped;
+};
+}
+}
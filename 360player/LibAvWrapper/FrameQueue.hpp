@@ -0,0 +1,134 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Bounded queue of decoded frames from the decoding thread (producer) to the
+	render thread (consumer), a ring buffer with one index per side.
+	Every consumer call is wait-free, so the render thread never waits for the
+	decoder. The producer sleeps while the ring is full and is woken by Pop
+	once half of it is free again, so a fast producer costs the consumer one
+	lock and wakeup per half a ring instead of one per frame.
+
+	End of stream is explicit: the producer calls Close after its last frame
+	and the consumer sees IsDone once it has taken every frame. Stop makes a
+	waiting or later Push fail, e.g. when playback is aborted.
+*/
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace IMT
+{
+	template <class T>
+	class FrameQueue
+	{
+	public:
+		FrameQueue(size_t capacity)
+			: capacity(std::max<size_t>(1, capacity)), slots(new std::shared_ptr<T>[this->capacity])
+			, head(0), tail(0), closed(false), stopped(false), producerWaiting(false) {}
+		FrameQueue(const FrameQueue&) = delete;
+		FrameQueue& operator=(const FrameQueue&) = delete;
+
+		//Add frame at the end, wait while the queue is full. Return false if the queue was stopped or closed [producer]
+		bool Push(std::shared_ptr<T> frame)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) >= capacity)
+			{
+				// Pop sees the flag or we see its new head, both are sequentially consistent
+				producerWaiting.store(true);
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [&] { return t - head.load() <= capacity / 2 || stopped.load(); });
+				producerWaiting.store(false);
+			}
+			if (stopped.load(std::memory_order_relaxed) || closed.load(std::memory_order_relaxed))
+				return false;
+
+			slots[t % capacity] = std::move(frame);
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		//No frame will be added anymore [producer]
+		void Close(void)
+		{
+			closed.store(true, std::memory_order_release);
+		}
+
+		//First frame of the queue, nullptr if it is empty. Valid until Pop [consumer]
+		const T* Front(void) const
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return nullptr;
+			return slots[h % capacity].get();
+		}
+
+		//Remove the first frame and move it to frame. Return false if the queue is empty [consumer]
+		bool Pop(std::shared_ptr<T>& frame)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+
+			frame = std::move(slots[h % capacity]);
+			head.store(h + 1);
+			if (producerWaiting.load() && tail.load(std::memory_order_relaxed) - (h + 1) <= capacity / 2)
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				cv.notify_one();
+			}
+			return true;
+		}
+
+		//Return true once the queue is closed and every frame has been taken [consumer]
+		bool IsDone(void) const
+		{
+			// frames pushed before Close are visible once closed is
+			return closed.load(std::memory_order_acquire)
+				&& head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+		}
+
+		//Make the producer give up [thread safe]
+		void Stop(void)
+		{
+			stopped.store(true);
+			std::lock_guard<std::mutex> lock(mtx);
+			cv.notify_all();
+		}
+
+		//Return the number of frames added but not taken yet [thread safe]
+		size_t Size(void) const
+		{
+			size_t h = head.load(std::memory_order_acquire);
+			size_t t = tail.load(std::memory_order_acquire);
+			return t > h ? t - h : 0;
+		}
+
+		//Return the maximum number of frames held at once
+		size_t Capacity(void) const
+		{
+			return capacity;
+		}
+
+	private:
+		const size_t capacity;
+		std::unique_ptr<std::shared_ptr<T>[]> slots;
+		//next frame to take, only written by the consumer
+		alignas(64) std::atomic<size_t> head;
+		//next slot to fill, only written by the producer
+		alignas(64) std::atomic<size_t> tail;
+		alignas(64) std::atomic<bool> closed;
+		std::atomic<bool> stopped;
+		//set while the producer sleeps on a full queue
+		alignas(64) std::atomic<bool> producerWaiting;
+		std::mutex mtx;
+		std::condition_variable cv;
+	};
+}
@@ -23,6 +23,8 @@ extern "C"
 
 #include <iostream>
 #include <stdexcept>
+#include <cstdint>
+#include <algorithm>
 
 #define DEBUG_VideoReader 0
 #if DEBUG_VideoReader
@@ -45,7 +47,8 @@ VideoReader::VideoReader(VideoTileStream* inputStreams, size_t numInputStreams,
 	: inputStreams(inputStreams), numInputStreams(numInputStreams), fmtCtx(nullptr), videoStreamIds(), outputFrames(bufferSize)
 	, nbFrames(0), startOffsetInSecond(startOffsetInSecond)
 	, decodingThread(), lastDisplayedPictureNumber(-1), stallingTime(std::chrono::milliseconds(0))
-	, videoStreamId(-1)
+	, videoStreamId(-1), displayedFrame(nullptr), displayedFrameNumber(0), uploadedFrameNumber()
+	, visibleTiles()
 {
 }
 
@@ -56,6 +59,8 @@ VideoReader::~VideoReader()
 	{
 		std::cout << "Join decoding thread\n";
 		outputFrames.Stop();
+		if (framePool)
+			framePool->Stop();
 		decodingThread.join();
 		std::cout << "Join decoding thread: done\n";
 	}
@@ -96,7 +101,7 @@ void printA(AVFormatContext* _a)
 
 void VideoReader::Init(unsigned nbFrames)
 {
-	nbFrames = nbFrames;
+	this->nbFrames = nbFrames;
 	PRINT_DEBUG_VideoReader("Register codecs");
 	av_register_all();
 
@@ -144,8 +149,10 @@ void VideoReader::Init(unsigned nbFrames)
 			throw(std::invalid_argument("Support only video with one video stream and one audio stream"));
 		}
 
+		// tiles are decoded in parallel by the decoder pool, a codec context of its own would
+		// only multiply the threads by the number of tiles
 		AVDictionary *opts_multithread = NULL;
-		av_dict_set(&opts_multithread, "threads", "2", 0);
+		av_dict_set(&opts_multithread, "threads", "1", 0);
 
 		for (unsigned j = 0; j < fmtCtx[i]->nb_streams; ++j)
 		{
@@ -168,9 +175,18 @@ void VideoReader::Init(unsigned nbFrames)
 				}
 			}
 		}
+		av_dict_free(&opts_multithread);
 	}
 
-	outputFrames.SetTotal(nbFrames);
+	size_t numDecoders = Config::instance()->decoderThreads;
+	if (numDecoders == 0)
+		numDecoders = std::thread::hardware_concurrency();
+	decoderPool.reset(new DecoderPool(std::min<size_t>(std::max<size_t>(1, numDecoders), numInputStreams)));
+	PRINT_DEBUG_VideoReader("Decoder threads = " << decoderPool->numWorkers());
+
+	// frames waiting in the queue, plus the one being composed and the one being displayed
+	framePool.reset(new FramePool<VideoFrame>(outputFrames.Capacity() + 2));
+
 	PRINT_DEBUG_VideoReader("Nb frames = " << nbFrames);
 
 	frameDurationMs = 1000.0 / (double(fmtCtx[0]->streams[videoStreamId]->r_frame_rate.num) / fmtCtx[0]->streams[videoStreamId]->r_frame_rate.den);
@@ -181,10 +197,9 @@ void VideoReader::Init(unsigned nbFrames)
 
 void VideoReader::RunDecoderThread(void)
 {
-	AVPacket pkt;
 	VideoFrame* tileFrames = new VideoFrame[numInputStreams];
+	std::vector<char> hasFrame(numInputStreams);
 
-	int ret = -1;
 	PRINT_DEBUG_VideoReader("Read next pkt");
 	std::cout << "[DEBUG] start offset: " << startOffsetInSecond << std::endl;
 	std::chrono::milliseconds m_timeOffset(long(startOffsetInSecond * 1000));
@@ -195,53 +210,76 @@ void VideoReader::RunDecoderThread(void)
 		av_seek_frame(fmtCtx[i], videoStreamId, seekTimeBasedUnit, 0);
 
 	double frameOffset = 0.0;
-	int framenum = 1;
+	unsigned nbDecodedFrames = 0;
+	bool tileUpload = Config::instance()->tileUpload;
 
-	AVFrame* testFrame = av_frame_alloc();
-
-	while (true)
+	// decodes the next frame of tile i, runs on a worker of the decoder pool
+	DecoderPool::Task decodeTile = [&](size_t i)
 	{
-		for (int i = 0; i < numInputStreams; i++)
+		AVPacket pkt;
+		int ret = -1;
+		hasFrame[i] = false;
+		while ((ret = av_read_frame(fmtCtx[i], &pkt)) >= 0)
 		{
-			bool hasFrame = false;
-			while ((ret = av_read_frame(fmtCtx[i], &pkt)) >= 0)
+			unsigned streamId = pkt.stream_index;
+			if (streamId == videoStreamId)
 			{
-				unsigned streamId = pkt.stream_index;
-				if (streamId == videoStreamId)
+				auto* codecCtx = fmtCtx[i]->streams[streamId]->codec;
+				ret = avcodec_send_packet(codecCtx, &pkt);
+
+				if (ret == 0)
 				{
-					auto* codecCtx = fmtCtx[i]->streams[streamId]->codec;
-					ret = avcodec_send_packet(codecCtx, &pkt);
+					ret = tileFrames[i].AvCodecReceiveFrame(codecCtx);
+					tileFrames[i].SetFrameOffset(frameOffset);
 
 					if (ret == 0)
 					{
-						ret = tileFrames[i].AvCodecReceiveFrame(codecCtx);
-						tileFrames[i].SetFrameOffset(frameOffset);
-
-						if (ret == 0)
-						{
-							hasFrame = true;
-							break;
-						}
+						hasFrame[i] = true;
+						av_packet_unref(&pkt);
+						break;
 					}
 				}
-				av_packet_unref(&pkt);
-			}
-			if (!hasFrame)
-			{
-				std::cout << "Decoding thread stopped: video done" << std::endl;
-				outputFrames.SetTotal(0);
-				delete[] tileFrames;
-				return;
 			}
+			av_packet_unref(&pkt);
+		}
+	};
+
+	while (true)
+	{
+		// every tile of this frame index is decoded before the frame is composed
+		decoderPool->run(numInputStreams, decodeTile);
+		if (std::find(hasFrame.begin(), hasFrame.end(), false) != hasFrame.end())
+		{
+			std::cout << "Decoding thread stopped: video done" << std::endl;
+			outputFrames.Close();
+			delete[] tileFrames;
+			return;
 		}
 
-		auto frame = std::make_shared<VideoFrame>();
+		if (nbDecodedFrames++ == nbFrames)
+		{
+			std::cout << "Decoding thread stopped: frame limit exceeded" << std::endl;
+			outputFrames.Close();
+			delete[] tileFrames;
+			return;
+		}
+
+		auto frame = framePool->Acquire();
+		if (frame == nullptr)
+		{
+			PRINT_DEBUG_VideoReader("Decoding thread stopped: frame pool stopped");
+			delete[] tileFrames;
+			return;
+		}
 		frame->SetFrameOffset(frameOffset);
 		frameOffset += frameDurationMs;
-		frame->mergeTilesToFrame(tileFrames, inputStreams, numInputStreams);
-		if (!outputFrames.Add(std::move(frame)))
+		if (tileUpload)
+			frame->referenceTiles(tileFrames, inputStreams, numInputStreams);
+		else
+			frame->mergeTilesToFrame(tileFrames, inputStreams, numInputStreams);
+		if (!outputFrames.Push(std::move(frame)))
 		{
-			std::cout << "Decoding thread stopped: frame limit exceeded" << std::endl;
+			PRINT_DEBUG_VideoReader("Decoding thread stopped: playback stopped");
 			delete[] tileFrames;
 			return;
 		}
@@ -259,32 +297,32 @@ IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::sy
 	auto pts = std::chrono::system_clock::time_point(std::chrono::seconds(-1));
 	size_t nbUsed = 0;
 	deadline = deadline - std::chrono::duration_cast<std::chrono::system_clock::duration>(stallingTime);
-	if (!outputFrames.IsAllDones())
+	if (!outputFrames.IsDone())
 	{
 		PRINT_DEBUG_VideoReader("Update video picture");
 		std::shared_ptr<VideoFrame> frame(nullptr);
 		bool done = false;
-		auto tmp_frame = outputFrames.Get();
 		auto frameDuration = std::chrono::milliseconds((long)frameDurationMs);
-		if (tmp_frame == nullptr && deadline >= currentTimestamp + frameDuration) // Stalling
+		if (outputFrames.Front() == nullptr && deadline >= currentTimestamp + frameDuration) // Stalling
 		{
 			stallingTime += deadline - (currentTimestamp + frameDuration);
 		}
 
 		while (!done)
 		{
-			tmp_frame = outputFrames.Get();
+			auto next = outputFrames.Front();
 
-			if (tmp_frame != nullptr)
+			if (next != nullptr)
 			{
-				currentTimestamp = tmp_frame->GetDisplayTimestamp();
+				currentTimestamp = next->GetDisplayTimestamp();
 
 				if (deadline >= currentTimestamp)
 				{
 					PRINT_DEBUG_VideoReader("Updated frame");
 					pts = currentTimestamp;
-					frame = std::move(tmp_frame);
-					outputFrames.Pop();
+					// a skipped frame goes back to the pool right away
+					framePool->Release(std::move(frame));
+					outputFrames.Pop(frame);
 					++lastDisplayedPictureNumber;
 					++nbUsed;
 				}
@@ -299,7 +337,14 @@ IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::sy
 			}
 		}
 
-		if (frame != nullptr && frame->IsValid())
+		if (frame != nullptr && frame->IsValid() && Config::instance()->tileUpload)
+		{
+			// kept until the next frame, tiles that become visible meanwhile are uploaded from it
+			framePool->Release(std::move(displayedFrame));
+			displayedFrame = std::move(frame);
+			++displayedFrameNumber;
+		}
+		else if (frame != nullptr && frame->IsValid())
 		{
 			auto w = frame->GetWidth();
 			auto h = frame->GetHeight();
@@ -338,6 +383,10 @@ IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::sy
 			//Stop sound
 			SDL_PauseAudio(1);
 		}
+		framePool->Release(std::move(frame));
+
+		if (displayedFrame != nullptr)
+			UploadTiles(textureIds);
 	}
 	else
 	{
@@ -347,3 +396,60 @@ IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::sy
 	}
 	return { lastDisplayedPictureNumber, nbUsed > 0 ? nbUsed - 1 : 0, deadline, pts, last };
 }
+
+void VideoReader::SetVisibleTiles(const std::vector<char>& visible)
+{
+	//a tile that comes into view is uploaded again, its region may hold an older frame
+	for (size_t t = 0; t < visible.size() && t < uploadedFrameNumber.size(); t++)
+		if (visible[t] && t < visibleTiles.size() && !visibleTiles[t])
+			uploadedFrameNumber[t] = SIZE_MAX;
+	visibleTiles.assign(visible.begin(), visible.end());
+}
+
+void VideoReader::UploadTiles(GLuint textureIds[3])
+{
+	auto w = displayedFrame->GetWidth();
+	auto h = displayedFrame->GetHeight();
+
+	if (uploadedFrameNumber.size() != numInputStreams)
+	{
+		//the plane textures are allocated once, the tiles are written into their regions
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, textureIds[i]);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, i ? w / 2 : w, i ? h / 2 : h, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		}
+		uploadedFrameNumber.assign(numInputStreams, 0);
+	}
+
+	for (int t = 0; t < numInputStreams; t++)
+	{
+		//already holds this frame, or not looked at: uploaded once it becomes visible
+		if (uploadedFrameNumber[t] == displayedFrameNumber || (t < visibleTiles.size() && !visibleTiles[t]))
+			continue;
+
+		auto tile = displayedFrame->GetTile(t);
+		if (tile == nullptr)
+			continue;
+
+		const DASH::SRD& srd = inputStreams[t].getSRD();
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, textureIds[i]);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, tile->linesize[i]);
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, i ? srd.x / 2 : srd.x, i ? srd.y / 2 : srd.y, i ? srd.w / 2 : srd.w, i ? srd.h / 2 : srd.h,
+				GL_RED, GL_UNSIGNED_BYTE, tile->data[i]);
+		}
+		uploadedFrameNumber[t] = displayedFrameNumber;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
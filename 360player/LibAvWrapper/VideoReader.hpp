@@ -26,7 +26,9 @@ extern "C"
 }
 #include <GL/glew.h>
 
-#include "Buffer.hpp"
+#include "FrameQueue.hpp"
+#include "DecoderPool.hpp"
+#include "FramePool.hpp"
 #include "DisplayFrameInfo.hpp"
 #include "IOMemoryContext.hpp"
 #include "VideoTileStream.hpp"
@@ -54,6 +56,12 @@ class VideoReader
 
         unsigned GetNbStream(void) const {return videoStreamIds.size();}
 
+        //With tile upload, only tiles marked visible (one entry per tile) are uploaded from now on
+        void SetVisibleTiles(const std::vector<char>& visible);
+
+        //Number of decoded frames waiting to be displayed
+        size_t GetNbBufferedFrames(void) const {return outputFrames.Size();}
+
     protected:
 
     private:
@@ -62,17 +70,25 @@ class VideoReader
 		IOMemoryContext** ioCtx;
         AVFormatContext** fmtCtx;
         std::vector<unsigned int> videoStreamIds;
-        IMT::Buffer<VideoFrame> outputFrames;
+        IMT::FrameQueue<VideoFrame> outputFrames;
+        std::unique_ptr<FramePool<VideoFrame>> framePool;
         unsigned nbFrames;
         float startOffsetInSecond;
 		double frameDurationMs;
         std::thread decodingThread;
+        std::unique_ptr<DecoderPool> decoderPool;
         size_t lastDisplayedPictureNumber;
         size_t videoStreamId;
 		std::chrono::system_clock::time_point currentTimestamp;
 		std::chrono::duration<double, std::milli> stallingTime;
+		//tile upload: the frame on display, its number and the number of the frame each tile's texture region holds
+		std::shared_ptr<VideoFrame> displayedFrame;
+		size_t displayedFrameNumber;
+		std::vector<size_t> uploadedFrameNumber;
+		std::vector<char> visibleTiles;
 
         void RunDecoderThread(void);
+        void UploadTiles(GLuint textureIds[3]);
 };
 }
 }
@@ -0,0 +1,112 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fixed set of worker threads the tiles of one output frame are decoded on.
+	run hands out the tile indices of a frame to the workers and returns once
+	all of them are decoded, so a frame is only composed from complete tiles
+	and a tile's decoder is never used by two threads at a time.
+*/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+namespace IMT {
+namespace LibAv {
+
+class DecoderPool
+{
+public:
+	typedef std::function<void(size_t task)> Task;
+
+	DecoderPool(size_t numWorkers)
+		: task(nullptr), numTasks(0), nextTask(0), doneTasks(0), generation(0), stopped(false)
+	{
+		numWorkers = std::max<size_t>(1, numWorkers);
+		for (size_t i = 0; i < numWorkers; i++)
+			workers.emplace_back(&DecoderPool::work, this);
+	}
+
+	DecoderPool(const DecoderPool&) = delete;
+	DecoderPool& operator=(const DecoderPool&) = delete;
+
+	~DecoderPool()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			stopped = true;
+		}
+		taskCv.notify_all();
+		for (auto& w : workers)
+			w.join();
+	}
+
+	// Calls task(0) to task(count - 1) on the workers and returns once all have returned.
+	// Only one thread may call run at a time.
+	void run(size_t count, const Task& task)
+	{
+		if (count == 0)
+			return;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		this->task = &task;
+		numTasks = count;
+		nextTask = 0;
+		doneTasks = 0;
+		generation++;
+		taskCv.notify_all();
+
+		doneCv.wait(lock, [&] { return doneTasks == numTasks; });
+		this->task = nullptr;
+	}
+
+	size_t numWorkers() const
+	{
+		return workers.size();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	const Task* task;
+	size_t numTasks;
+	size_t nextTask;
+	size_t doneTasks;
+	size_t generation;
+	bool stopped;
+	std::mutex mtx;
+	std::condition_variable taskCv;
+	std::condition_variable doneCv;
+
+	void work()
+	{
+		size_t seen = 0;
+		std::unique_lock<std::mutex> lock(mtx);
+		while (true)
+		{
+			taskCv.wait(lock, [&] { return stopped || (generation != seen && nextTask < numTasks); });
+			if (stopped)
+				return;
+
+			// take tasks of this frame until none are left
+			seen = generation;
+			while (nextTask < numTasks)
+			{
+				size_t t = nextTask++;
+				lock.unlock();
+				(*task)(t);
+				lock.lock();
+
+				if (++doneTasks == numTasks)
+					doneCv.notify_one();
+			}
+		}
+	}
+};
+}
+}
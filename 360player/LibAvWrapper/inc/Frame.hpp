@@ -16,6 +16,7 @@ extern "C"
 #include "libavutil/opt.h"
 }
 #include <chrono>
+#include <vector>
 
 #include <iostream>
 #include <omp.h>
@@ -72,7 +73,11 @@ class VideoFrame final : public Frame
 {
 public:
 	VideoFrame(void) : Frame() {}
-	virtual ~VideoFrame(void) = default;
+	virtual ~VideoFrame(void)
+	{
+		for (auto tile : tileRefs)
+			av_frame_free(&tile);
+	}
 
 	auto AvCodecReceiveFrame(AVCodecContext* codecCtx)
 	{
@@ -88,10 +93,15 @@ public:
 		int dstWidth = srd.w * srd.th;
 		int dstHeight = srd.h * srd.tv;
 
-		av_image_alloc(m_framePtr->data, m_framePtr->linesize, dstWidth, dstHeight, AV_PIX_FMT_YUV420P, 1);
+		// a recycled frame keeps its picture
+		if (m_framePtr->data[0] == nullptr || m_framePtr->width != dstWidth || m_framePtr->height != dstHeight)
+		{
+			av_freep(&m_framePtr->data[0]);
+			av_image_alloc(m_framePtr->data, m_framePtr->linesize, dstWidth, dstHeight, AV_PIX_FMT_YUV420P, 1);
 
-		m_framePtr->width = dstWidth;
-		m_framePtr->height = dstHeight;
+			m_framePtr->width = dstWidth;
+			m_framePtr->height = dstHeight;
+		}
 
 		if (Config::instance()->demo)
 		{
@@ -164,9 +174,35 @@ public:
 		m_haveFrame = true;
 	}
 
+	// Keeps a reference to the decoded picture of each tile instead of copying them into
+	// one picture, the tiles are uploaded into the textures separately
+	void referenceTiles(const VideoFrame* tiles, const VideoTileStream* streams, size_t numTiles)
+	{
+		while (tileRefs.size() < numTiles)
+			tileRefs.push_back(av_frame_alloc());
+
+		for (int t = 0; t < numTiles; t++)
+		{
+			av_frame_unref(tileRefs[t]);
+			if (tiles[t].IsValid())
+				av_frame_ref(tileRefs[t], tiles[t].m_framePtr);
+		}
+
+		const DASH::SRD& srd = streams->getSRD();
+		m_framePtr->width = srd.w * srd.th;
+		m_framePtr->height = srd.h * srd.tv;
+		m_haveFrame = true;
+	}
+
+	// decoded picture of tile t kept by referenceTiles, nullptr if there is none
+	const AVFrame* GetTile(size_t t) const { return t < tileRefs.size() && tileRefs[t]->data[0] ? tileRefs[t] : nullptr; }
+
 	int* GetRowLength(void) { if (IsValid()) { return m_framePtr->linesize; } else { return nullptr; } }
 	int GetWidth(void) const { if (IsValid()) { return m_framePtr->width; } else { return -1; } }
 	int GetHeight(void) const { if (IsValid()) { return m_framePtr->height; } else { return -1; } }
+
+private:
+	std::vector<AVFrame*> tileRefs;
 };
 }
 }
@@ -13,18 +13,54 @@
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <limits>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
+#include "QualitySolver.hpp"
+#include "BandwidthEstimator.hpp"
+#include "HeadMotionPredictor.hpp"
 #include "mpd.h"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
 #include "ConfigParser.hpp"
 #include "Monitor.hpp"
+#include "AllocationCounter.hpp"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
 #define SAMPLERES 8
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
+// in-flight requests are only judged after this much transfer time
+#define MIN_PROGRESS_MS 50
+
+// segment durations a fully visible tile's request is brought forward by. Deadlines of consecutive
+// segments are one segment duration apart, so a visible tile of the next segment overtakes
+// the tiles of the current one that are less than half as visible
+#define RANK_VISIBILITY_SEGMENTS 2.0
+
+// prior probability that the proxy holds a tile, in the popular quality of the segment or in any other
+#define HIT_PRIOR_POPULAR 0.8
+#define HIT_PRIOR_OTHER 0.1
+// weight of the prior in observed requests, and decay of the observed X-Cache history per request
+#define HIT_PRIOR_WEIGHT 2.0
+#define HIT_HISTORY_DECAY 0.8
+
+// MPC controller: budgets a segment can be planned with, as multiples of the predicted throughput
+#define MPC_LEVELS 6
+static const double mpcBudgetLevels[MPC_LEVELS] = { 0.25, 0.5, 0.75, 1.0, 1.5, 2.0 };
+// penalty per second of stall in units of the highest utility, and per change of utility between segments
+#define MPC_REBUFFER_PENALTY 4.0
+#define MPC_SWITCH_PENALTY 1.0
+
+// probabilistic viewport prediction: head rotations drawn per instant, and deviation
+// of the predicted yaw and pitch in degrees at no look-ahead (grows by predictionUncertainty per second)
+#define VIEWPORT_DRAWS 16
+#define PREDICTION_DEVIATION_BASE 1.0
+
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
 #define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
 
@@ -43,10 +79,48 @@ class AdaptionUnit
 public:
 	struct NormalizedCoordinate { double x, y; };
 
+	// A tile to download. Pending requests of all segments are served in ascending rank:
+	// the deadline, brought forward by up to RANK_VISIBILITY_SEGMENTS segment durations the more visible the tile is.
+	struct TileRequest
+	{
+		int segment;
+		int tile;
+		int quality;
+		long long start;	// epoch ms the request was planned
+		long long deadline;	// epoch ms the tile is needed by, 0 if none
+		long long rank;
+		bool upgrade;		// replaces a buffered tile, a late upgrade is aborted instead of downgraded
+	};
+
+	struct TileDownload
+	{
+		int segment;
+		int tile;
+		int quality;
+		std::shared_ptr<httplib::Response> res;
+	};
+
+	// Takes the body of a tile while it is downloaded, the response body stays empty then.
+	// begin is called with the quality before a request starts and fails once the data
+	// received so far is being read and can not be replaced by a downgrade anymore.
+	struct TileSink
+	{
+		std::function<bool(int quality)> begin;
+		httplib::ContentReceiver receive;
+	};
+
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
-		: mpd(mpd), httpClient(httpClient)
-		, bytesDownloaded(0), durationDownload(0)
-		, bandwidthEstimate(0)
+		: mpd(mpd), httpClient(httpClient), monitor(nullptr)
+		, bandwidthEstimate(0), bufferLevel(mpd->segmentDuration()), playoutBuffer(0), transfersInFlight(0), transfersUpdated(0), transfersIntegral(0)
+		, initialBandwidth(BandwidthEstimator::load(Config::instance()->bandwidthFile, 2000000))
+		, estimator(BandwidthEstimator::create(Config::instance()->bandwidthEstimator, initialBandwidth))
+		, hitEstimator(BandwidthEstimator::create(Config::instance()->bandwidthEstimator, initialBandwidth))
+		, hitBandwidthEstimate(initialBandwidth)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
+		, qualitySolver(mpd->period.adaptationSets.size(), mpd->period.adaptationSets[0].representations.size(), [mpd](int tile, int quality)
+			{ return mpd->period.adaptationSets[tile].representations[quality].bandwidth / 8.0; })
+		, headPredictor(250, Config::instance()->predictionDamping)
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -72,6 +146,48 @@ public:
 			for (int y = -SAMPLERES/2; y <= SAMPLERES/2; y++)
 				samplePoints[i++] = { sampleFun(x), sampleFun(y) };
 
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
+
+		int numTiles = mpd->period.adaptationSets.size();
+		tileQuality.assign(numTiles, 0);
+		tileVisibility.assign(numTiles, 0);
+		visibility.assign(numTiles, 0.0);
+		tileOrder.resize(numTiles);
+		std::iota(tileOrder.begin(), tileOrder.end(), 0);
+		requests.reserve(numTiles);
+		upgrades.reserve(numTiles);
+
+		int numQualities = mpd->period.adaptationSets[0].representations.size();
+		transferCost.assign(numTiles * numQualities, 0.0);
+		cacheHistory.assign(numTiles * numQualities, { 0.0, 0.0 });
+
+		maxUtility = 0;
+		for (auto& adaptationSet : mpd->period.adaptationSets)
+			maxUtility = std::max(maxUtility, std::log(adaptationSet.representations[0].bandwidth / (double)adaptationSet.representations.back().bandwidth));
+		lastUtility = 0;
+		mpcQuality.assign(MPC_LEVELS, std::vector<int>(numTiles));
+
+		// standard normal yaw and pitch offsets, Box-Muller on a Halton sequence so they are spread evenly
+		auto halton = [](int i, int base)
+		{
+			double f = 1, r = 0;
+			for (; i > 0; i /= base)
+			{
+				f /= base;
+				r += f * (i % base);
+			}
+			return r;
+		};
+		for (int i = 1; i <= VIEWPORT_DRAWS; i++)
+		{
+			double radius = std::sqrt(-2 * std::log(halton(i, 2)));
+			double angle = 2 * PI * halton(i, 3);
+			viewportOffsets.push_back({ radius * std::cos(angle), radius * std::sin(angle) });
+		}
+		tileProbability.assign(Config::instance()->viewportInstants * numTiles, 0.0);
+		crowdVisibility.assign(numTiles, 0.0);
+
 		if (Config::instance()->monitor)
 		{
 			monitor = new Monitor();
@@ -91,20 +207,24 @@ public:
 		startAdaption(cb, 0, true);
 	}
 
-	std::vector<int> startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
+	// Chooses the tile qualities of a segment. Returns a request per tile, most visible first,
+	// valid until the next call. Does not allocate after the init call, apart from the monitor.
+	const std::vector<TileRequest>& startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
 	{
-		std::vector<int> tileDownloadOrder;
+		COUNT_NO_ALLOCATIONS_SCOPE("startAdaption", !init);
+		std::fill(visibility.begin(), visibility.end(), 0.0);
+		// orientations the render thread looked at but found no visibility for
+		visibilityTable.fillMissed();
 
-		if (init)
-			bandwidthEstimate = 2000000;
-		else if (durationDownload != 0 && bytesDownloaded != 0)
-			bandwidthEstimate = bytesDownloaded * (1000.0 / durationDownload);
+		{
+			std::lock_guard<std::mutex> l(downloadMtx);
+			bandwidthEstimate = init ? initialBandwidth : estimator->estimate();
+			hitBandwidthEstimate = init ? initialBandwidth : hitEstimator->estimate();
+		}
+		updateTransferCost(segment);
 
 		auto timestamp = headRotations[headRotations.size() - 1].first;
 
-		durationDownload = 0;
-		bytesDownloaded = 0;
-
 		std::cout << "Start adaption: " << bandwidthEstimate << std::endl;
 		
 		size_t neededBandwidth = 0;
@@ -112,39 +232,73 @@ public:
 		int numTiles = mpd->period.adaptationSets.size();
 
 		// start with all tiles in lowest quality
-		for (int i = 0; i < numTiles; i++)
-			tileQuality[i] = numQualityLevels;
+		std::fill(tileQuality.begin(), tileQuality.end(), numQualityLevels);
 
 		bool transition = false;
 
 		auto config = Config::instance();
-		if (config->popularity && !config->viewportPrediction)
+
+		// head motion cannot be predicted for segments further than one segment ahead of playback,
+		// those are fetched by popularity or in lowest quality unless the crowd prior backs the prediction up
+		bool farAhead = bufferLevel > mpd->segmentDuration() && !config->crowdPrediction;
+
+		if (config->mpc)
+		{
+			// the plan accounts for the buffer itself and lowers the budget on purpose,
+			// neither the buffer level nor the budget hands the segment over to popularity
+			predictTileVisibility(headRotations, segment);
+			relativeVisibility();
+			planMpc();
+		}
+		else if (config->popularity && (!config->viewportPrediction || farAhead))
 		{
 			transition = true;
 		}
-		else if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		else if (!farAhead && config->qualitySolver == Config::Solver::Knapsack)
 		{
-			auto tileVisibility = predictTileVisibility(headRotations);
+			predictTileVisibility(headRotations, segment);
+			relativeVisibility();
+
+			// best visibility weighted qualities the bandwidth allows, tiles outside the viewport stay lowest
+			int numQualities = numQualityLevels + 1;
+			qualitySolver.setCost([this, numQualities](int tile, int quality) { return transferCost[tile * numQualities + quality]; });
+			double budget = bandwidthEstimate * .75;
+			qualitySolver.solve(visibility, budget, tileQuality);
+
+			// trigger transition if the budget runs out before the visible tiles are covered,
+			// as the greedy path does: each tile is raised a level per 1 / numQualityLevels of its relative visibility
+			if (config->popularity && config->transitions)
+			{
+				double coveredCost = 0;
+				for (int i = 0; i < numTiles; i++)
+				{
+					int levels = std::lround(visibility[i] * numQualityLevels);
+					coveredCost += transferCost[i * numQualities + numQualityLevels - levels];
+				}
+				transition = coveredCost > budget;
+				if (transition)
+					std::cout << "Transition to popularity" << std::endl;
+			}
+		}
+		else if (!farAhead)
+		{
+			predictTileVisibility(headRotations, segment);
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
+			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end());
+			auto maxVisibility = *highestPriorityTile;
 			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
 
-			// generate tile download order by visibility
-			std::sort(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			for (std::pair<int, int> tilevis : tileVisibility)
-				tileDownloadOrder.push_back(tilevis.second);
-			for (int t = 0; t < numTiles; t++)
-				if (std::find(tileDownloadOrder.begin(), tileDownloadOrder.end(), t) == tileDownloadOrder.end())
-					tileDownloadOrder.push_back(t);
+			// visible tiles are requested first, even if all of them stay in lowest quality
+			relativeVisibility();
 
-			while (highestPriorityTile->first != 0)
+			while (*highestPriorityTile != 0 && bandwidthNeededForTileQuality(tileQuality) < bandwidthEstimate * .75)
 			{
 				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
+				int tile = highestPriorityTile - tileVisibility.begin();
+				tileQuality[tile] = std::max(0, tileQuality[tile] - 1);
 
 				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
+				if (bandwidthNeededForTileQuality(tileQuality) > bandwidthEstimate * .75)
 				{
 					if (config->popularity && config->transitions)
 					{
@@ -155,30 +309,46 @@ public:
 				}
 
 				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
+				*highestPriorityTile = std::max(0, *highestPriorityTile - visibilityPerQualityLevel);
 
 				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
+				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end());
 			}
 		}
+		else
+		{
+			// too far ahead to choose qualities by head motion, the current viewport still ranks the requests
+			predictTileVisibility(headRotations, segment);
+			relativeVisibility();
+		}
 
 		if (transition)
 		{
-			tileQuality = mpd->tilePopularity(segment);
+			auto& popularity = mpd->tilePopularity(segment);
 
-			// generate tile download order by popularity
-			tileDownloadOrder.clear();
-			for (int q = 0; q <= numQualityLevels; q++)
-				for (int i = 0; i < numTiles; i++)
-					if (tileQuality[i] == q)
-						tileDownloadOrder.push_back(i);
+			// popular tiles are the likely visible ones
+			for (int i = 0; i < numTiles; i++)
+			{
+				auto it = popularity.find(i);
+				tileQuality[i] = it != popularity.end() ? it->second : 0;
+				visibility[i] = numQualityLevels ? (numQualityLevels - tileQuality[i]) / (double)numQualityLevels : 0;
+			}
 		}
 
-		monitor->addsample(timestamp / 1000.0, bandwidthEstimate * 8 / 1000000, transition);
-		
-		downloadStartTime = TIME_NOW_EPOCH_MS;
+		if (monitor)
+		{
+			COUNT_ALLOCATIONS_SEPARATELY("monitor");
+			monitor->addsample(timestamp / 1000.0, bandwidthEstimate * 8 / 1000000, transition);
+		}
 
-		return tileDownloadOrder;
+		requests.clear();
+		for (int i = 0; i < numTiles; i++)
+			requests.push_back(request(segment, i, tileQuality[i], visibility[i], false));
+		// ties keep tile order, std::stable_sort would allocate
+		std::sort(requests.begin(), requests.end(), [](const TileRequest& r1, const TileRequest& r2)
+			{ return r1.rank != r2.rank ? r1.rank < r2.rank : r1.tile < r2.tile; });
+
+		return requests;
 		//for (int i = 0; i < 4; i++)
 		//{
 		//	for (int j = 0; j < 4; j++)
@@ -204,38 +374,137 @@ public:
 		//}
 	}
 
-	auto download(int tile, int segment = -1)
+	// Seconds of video buffered ahead of playback when the next segment is adapted,
+	// i.e. the time left until that segment is displayed
+	void setBufferLevel(double seconds)
+	{
+		bufferLevel = seconds;
+	}
+
+	double getBufferLevel() const
+	{
+		return bufferLevel;
+	}
+
+	// Seconds of video that can be played without further downloads,
+	// the buffer the MPC controller starts from
+	void setPlayoutBuffer(double seconds)
 	{
-		if (segment != -1)
-			currentSegment = segment;
+		playoutBuffer = seconds;
+	}
+
+	// keeps the current estimate as the starting estimate of the next session
+	void storeBandwidthEstimate()
+	{
+		std::lock_guard<std::mutex> l(downloadMtx);
+		BandwidthEstimator::store(Config::instance()->bandwidthFile, estimator->estimate());
+	}
+
+	// Requests all tiles of a segment in lowest quality without deadline, to start playback quickly
+	std::vector<TileRequest> lowestQualityRequests(int segment)
+	{
+		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
+
+		std::vector<TileRequest> requests;
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
+			requests.push_back({ segment, i, lowq, TIME_NOW_EPOCH_MS, 0, 0, false });
+		return requests;
+	}
+
+	// Plans an upgrade of a segment that is already buffered: tiles that the current head
+	// motion predicts more visible than the buffered quality reflects are raised, most visible
+	// first, as far as the bandwidth estimate allows before the segment is displayed.
+	// Returns the (tile, quality) pairs to download again, valid until the next call.
+	const std::vector<TileRequest>& startUpgrade(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, const std::vector<int>& bufferedQuality)
+	{
+		COUNT_NO_ALLOCATIONS_SCOPE("startUpgrade", true);
+		upgrades.clear();
+		if (!Config::instance()->viewportPrediction)
+			return upgrades;
 
-		bool qOverride = false;
 		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
-		if (TIME_NOW_EPOCH_MS - downloadStartTime > 0.75 * (mpd->segmentDuration() * 1000))
+
+		updateTransferCost(segment);
+		predictTileVisibility(headRotations, segment);
+		std::sort(tileOrder.begin(), tileOrder.end(), [this](int t1, int t2)
+			{ return tileVisibility[t1] != tileVisibility[t2] ? tileVisibility[t1] > tileVisibility[t2] : t1 < t2; });
+		double maxVisibility = tileVisibility[tileOrder.front()];
+		if (maxVisibility == 0)
+			return upgrades;
+
+		// bytes at origin throughput that can still be fetched before the segment is displayed
+		double budget = bandwidthEstimate * .75 * bufferLevel;
+
+		for (int tile : tileOrder)
 		{
-			qOverride = true;
-			std::cout << "q override "<< TIME_NOW_EPOCH_MS - downloadStartTime << " " << 0.75 * (mpd->segmentDuration() * 1000) << std::endl;
+			if (tileVisibility[tile] == 0)
+				break;
+
+			int quality = lowq - (int)std::lround(lowq * tileVisibility[tile] / maxVisibility);
+			if (quality >= bufferedQuality.at(tile))
+				continue;
+
+			double bytes = transferCost[tile * (lowq + 1) + quality] * mpd->segmentDuration();
+			if (bytes > budget)
+				continue;
+
+			budget -= bytes;
+			upgrades.push_back(request(segment, tile, quality, tileVisibility[tile] / maxVisibility, true));
 		}
-		
-		auto timer = TIME_NOW_EPOCH_MS;
-		auto res = httpClient->Get(mpd->getUrl(currentSegment, tile, qOverride ? lowq : tileQuality[tile]).c_str());
-		auto duration = TIME_NOW_EPOCH_MS - timer;
 
-		bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
-		if (!cacheHit)
+		return upgrades;
+	}
+
+	// Downloads a requested tile. A request that is projected to finish after its deadline
+	// is aborted and re-issued at the lowest quality. A late upgrade (see startUpgrade) is
+	// aborted without replacement and res is nullptr, as it is for failed and non-2xx responses
+	// and when the sink refuses the tile before the request starts.
+	// May be called concurrently for different tiles of any segment.
+	TileDownload download(const TileRequest& request, const TileSink* sink = nullptr)
+	{
+		int segment = request.segment;
+		int tile = request.tile;
+		int quality = request.quality;
+		bool upgrade = request.upgrade;
+		long long deadline = request.deadline;
+
+		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
+
+		if (!upgrade && deadline && TIME_NOW_EPOCH_MS - request.start > 0.75 * (deadline - request.start))
+		{
+			quality = lowq;
+			std::cout << "q override "<< TIME_NOW_EPOCH_MS - request.start << " " << 0.75 * (deadline - request.start) << std::endl;
+		}
+
+		// the decoder already reads what an earlier request streamed, nothing may be written into it
+		if (sink && !sink->begin(quality))
+			return { segment, tile, quality, nullptr };
+
+		// a streamed tile is only given up as long as nobody reads it
+		std::function<bool()> giveUp;
+		if (sink && !upgrade)
+			giveUp = [&] { return sink->begin(lowq); };
+
+		bool late = false;
+		bool cacheHit = false;
+		auto res = get(mpd->getUrl(segment, tile, quality), quality != lowq ? deadline : 0, late, cacheHit, sink, giveUp);
+		if (res || late)
+			addCacheResult(tile, quality, cacheHit);
+		if (late && !upgrade)
 		{
-			durationDownload += duration;
-			bytesDownloaded += res->body.size();
+			quality = lowq;
+			res = get(mpd->getUrl(segment, tile, quality), 0, late, cacheHit, sink, nullptr);
+			if (res)
+				addCacheResult(tile, quality, cacheHit);
 		}
 
-		return res;
+		return { segment, tile, quality, res };
 	}
 
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		for (int i = 0; i < 16; i++)
 			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
@@ -250,74 +519,367 @@ public:
 		std::cout << std::endl;
 	}
 
-	const std::map<int, int>& getCurrentTileQuality() const
+	// Marks the tiles a viewport at headRotation, or turned by up to marginDegrees from it, falls on.
+	// Used by the render thread, safe to call while an adaptation runs and never waits: if the
+	// visibility table has not been filled for one of these orientations yet, all tiles are marked
+	// and the next adaptation fills it.
+	void visibleTiles(const Quaternion& headRotation, double marginDegrees, std::vector<char>& visible) const
+	{
+		int numTiles = visibilityTable.tiles();
+		visible.assign(numTiles, false);
+		bool miss = false;
+
+		// the viewport samples can miss the edge of a tile and the head moves until the next frame
+		double margin = marginDegrees * PI / 180.0;
+		const std::pair<double, double> offsets[] = { { 0, 0 }, { margin, 0 }, { -margin, 0 }, { 0, margin }, { 0, -margin } };
+		for (auto& offset : offsets)
+		{
+			auto samples = visibilityTable.find(headRotation * Quaternion::FromEuler(offset.first, offset.second, 0));
+			if (samples == nullptr)
+			{
+				miss = true;
+				continue;
+			}
+			for (int t = 0; t < numTiles; t++)
+				if (samples[t])
+					visible[t] = true;
+		}
+		if (miss)
+			visible.assign(numTiles, true);
+	}
+
+	const std::vector<int>& getCurrentTileQuality() const
 	{
 		return tileQuality;
 	}
 
+	// Probability that tile is visible at the given instant of the segment last adapted,
+	// with probabilistic viewport prediction (viewportInstants > 0)
+	double getTileProbability(int instant, int tile) const
+	{
+		return tileProbability.at(instant * tileVisibility.size() + tile);
+	}
+
 private:
 	const DASH::MPD* mpd;
 	httplib::Client* httpClient;
 	Monitor* monitor;
 	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
-	std::map<int, int> tileQuality;
-	int currentSegment;	
 	size_t bandwidthEstimate;
-	size_t bytesDownloaded;
-	int durationDownload;
-	long long downloadStartTime;
+	double bufferLevel;
+	double playoutBuffer;
+	int transfersInFlight;	// guarded by downloadMtx, as are the two below
+	long long transfersUpdated;
+	double transfersIntegral;
+	double initialBandwidth;
+	std::unique_ptr<BandwidthEstimator> estimator;	// origin, i.e. cache misses, guarded by downloadMtx
+	std::unique_ptr<BandwidthEstimator> hitEstimator;	// proxy, i.e. cache hits, guarded by downloadMtx
+	size_t hitBandwidthEstimate;
+	std::mutex downloadMtx;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
-	
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
+	QualitySolver qualitySolver;
+	HeadMotionPredictor headPredictor;
+
+	// Decision state indexed by tile, sized in the constructor and only
+	// used by the thread that adapts
+	std::vector<int> tileQuality;
+	std::vector<int> tileVisibility;	// viewport samples per tile, or expected visible ms with probabilistic prediction
+	std::vector<double> visibility;		// relative to the most visible tile
+	std::vector<int> tileOrder;
+	std::vector<TileRequest> requests;
+	std::vector<TileRequest> upgrades;
+	std::vector<double> tileProbability;	// indexed by instant * tiles + tile
+	std::vector<std::pair<double, double>> viewportOffsets;	// yaw and pitch in deviations
+	std::vector<double> crowdVisibility;	// of the segment predicted last
+	// indexed by tile * qualities + quality: expected transfer time as bytes at origin throughput
+	std::vector<double> transferCost;
+
+	// decayed count of requests and of cache hits of a representation, guarded by downloadMtx
+	struct CacheHistory
 	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
+		double requests;
+		double hits;
+	};
+	std::vector<CacheHistory> cacheHistory;
+
+	// MPC controller state: qualities, utility in quality seconds and download seconds of a segment per budget level
+	double maxUtility;
+	double lastUtility;
+	std::vector<std::vector<int>> mpcQuality;
+	double mpcUtility[MPC_LEVELS];
+	double mpcDownload[MPC_LEVELS];
+
+	// least squares line through the points added so far
+	struct Regression
+	{
+		size_t n = 0;
+		double s_x = 0, s_y = 0, s_xx = 0, s_xy = 0;
+
+		void add(double x, double y)
+		{
+			n++;
+			s_x += x;
+			s_y += y;
+			s_xx += x * x;
+			s_xy += x * y;
+		}
+
+		double operator()(double x) const
+		{
+			const auto slope = (n * s_xy - s_x * s_y) / (n * s_xx - s_x * s_x);
+			const auto intercept = (s_y - slope * s_x) / n;
+			return x * slope + intercept;
+		}
+	};
+
+	// fills visibility from tileVisibility
+	void relativeVisibility()
+	{
+		auto maxVisibility = *std::max_element(tileVisibility.begin(), tileVisibility.end());
+		for (size_t i = 0; i < tileVisibility.size(); i++)
+			visibility[i] = maxVisibility ? tileVisibility[i] / (double)maxVisibility : 0;
 	}
 
-	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
+	// Chooses tileQuality by model predictive control: each segment of the horizon is planned at one
+	// of the budget levels, the playout buffer is simulated with the predicted throughput and the
+	// first step of the plan with the best trade-off of quality, stalls and quality switches is taken.
+	// The predicted viewport stands in for the viewport of all segments of the horizon.
+	void planMpc()
 	{
-		const auto n = x.size();
-		const auto s_x = std::accumulate(x.begin(), x.end(), 0.0);
-		const auto s_y = std::accumulate(y.begin(), y.end(), 0.0);
-		const auto s_xx = std::inner_product(x.begin(), x.end(), x.begin(), 0.0);
-		const auto s_xy = std::inner_product(x.begin(), x.end(), y.begin(), 0.0);
-		const auto slope = (n * s_xy - s_x * s_y) / (n * s_xx - s_x * s_x);
-		const auto intercept = (s_y - slope * s_x) / n;
-		return [slope, intercept](double x) { return x * slope + intercept; };
+		int numQualities = mpd->period.adaptationSets[0].representations.size();
+		double segmentDuration = mpd->segmentDuration();
+		double throughput = std::max<size_t>(1, bandwidthEstimate);
+		double weightSum = std::accumulate(visibility.begin(), visibility.end(), 0.0);
+
+		qualitySolver.setCost([this, numQualities](int tile, int quality) { return transferCost[tile * numQualities + quality]; });
+		for (int l = 0; l < MPC_LEVELS; l++)
+		{
+			double cost = qualitySolver.solve(visibility, throughput * mpcBudgetLevels[l], mpcQuality[l]);
+			mpcUtility[l] = weightSum ? qualitySolver.value(visibility, mpcQuality[l]) / weightSum * segmentDuration : 0;
+			mpcDownload[l] = cost * segmentDuration / throughput;
+		}
+
+		int level = 0;
+		mpcObjective(0, playoutBuffer, lastUtility, &level);
+		std::copy(mpcQuality[level].begin(), mpcQuality[level].end(), tileQuality.begin());
+		lastUtility = mpcUtility[level];
 	}
 
-	std::vector<std::pair<int, int>> predictTileVisibility(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations) const
+	// Best objective of the horizon from step on, given the buffer before the step is downloaded.
+	// Writes the best level of the step to level if given.
+	double mpcObjective(int step, double buffer, double previousUtility, int* level = nullptr) const
 	{
-		std::map<int, int> tileVisibilityMap;
+		if (step == Config::instance()->mpcHorizon)
+			return 0;
+
+		double segmentDuration = mpd->segmentDuration();
+		double capacity = Config::instance()->bufferSegments * segmentDuration;
+
+		double best = -std::numeric_limits<double>::infinity();
+		for (int l = 0; l < MPC_LEVELS; l++)
+		{
+			double stall = std::max(0.0, mpcDownload[l] - buffer);
+			// downloads pause while the buffer is full
+			double next = std::min(capacity, std::max(0.0, buffer - mpcDownload[l]) + segmentDuration);
+			double objective = mpcUtility[l] - MPC_REBUFFER_PENALTY * maxUtility * stall
+				- MPC_SWITCH_PENALTY * std::abs(mpcUtility[l] - previousUtility)
+				+ mpcObjective(step + 1, next, mpcUtility[l]);
+			if (objective > best)
+			{
+				best = objective;
+				if (level)
+					*level = l;
+			}
+		}
+		return best;
+	}
+
+	// a request due when the buffered time runs out, visibility in [0, 1]
+	TileRequest request(int segment, int tile, int quality, double visibility, bool upgrade) const
+	{
+		auto now = TIME_NOW_EPOCH_MS;
+		long long deadline = now + bufferLevel * 1000;
+		long long rank = deadline - std::lround(visibility * RANK_VISIBILITY_SEGMENTS * mpd->segmentDuration() * 1000);
+		return { segment, tile, quality, now, deadline, rank, upgrade };
+	}
+
+	// Bytes per second of each representation for the bandwidth budget: a tile the proxy
+	// probably holds costs less than its bitrate, by the ratio of origin to proxy throughput.
+	// Hit probabilities combine the popularity of the MPD with the X-Cache history.
+	void updateTransferCost(int segment)
+	{
+		int numTiles = mpd->period.adaptationSets.size();
+		int numQualities = mpd->period.adaptationSets[0].representations.size();
+
+		// a hit is never assumed slower than a miss
+		double hitRatio = hitBandwidthEstimate > bandwidthEstimate ? bandwidthEstimate / (double)hitBandwidthEstimate : 1.0;
+		bool cacheAware = Config::instance()->cacheAware && hitRatio < 1.0;
+
+		auto popularity = mpd->period.segmentTilePopularity.find(segment);
+		bool hasPopularity = popularity != mpd->period.segmentTilePopularity.end();
+
+		std::lock_guard<std::mutex> l(downloadMtx);
+		for (int t = 0; t < numTiles; t++)
+		{
+			int popularQuality = -1;
+			if (hasPopularity)
+			{
+				auto it = popularity->second.find(t);
+				if (it != popularity->second.end())
+					popularQuality = it->second;
+			}
+
+			for (int q = 0; q < numQualities; q++)
+			{
+				double bytes = mpd->period.adaptationSets[t].representations[q].bandwidth / 8.0;
+				if (!cacheAware)
+				{
+					transferCost[t * numQualities + q] = bytes;
+					continue;
+				}
+
+				double prior = q == popularQuality ? HIT_PRIOR_POPULAR : HIT_PRIOR_OTHER;
+				auto& history = cacheHistory[t * numQualities + q];
+				double hit = (history.hits + HIT_PRIOR_WEIGHT * prior) / (history.requests + HIT_PRIOR_WEIGHT);
+				transferCost[t * numQualities + q] = bytes * (1 - hit + hit * hitRatio);
+			}
+		}
+	}
+
+	void addCacheResult(int tile, int quality, bool cacheHit)
+	{
+		int numQualities = mpd->period.adaptationSets[0].representations.size();
+
+		std::lock_guard<std::mutex> l(downloadMtx);
+		auto& history = cacheHistory[tile * numQualities + quality];
+		history.requests = history.requests * HIT_HISTORY_DECAY + 1;
+		history.hits = history.hits * HIT_HISTORY_DECAY + (cacheHit ? 1 : 0);
+	}
+
+	// Transfers in flight summed over time until now, in transfer milliseconds.
+	// The difference over a transfer divided by its duration is the average number in flight.
+	double transferMs(long long now)
+	{
+		// clocks read on other threads may be a bit ahead
+		now = std::max(now, transfersUpdated);
+		if (transfersUpdated)
+			transfersIntegral += transfersInFlight * (double)(now - transfersUpdated);
+		transfersUpdated = now;
+		return transfersIntegral;
+	}
+
+	// GET that records the throughput of cache hits and misses separately. If deadline is set,
+	// the request is aborted (late = true, nullptr returned) once its projected end lies after the deadline.
+	// giveUp decides whether a request projected to miss the deadline is aborted, without it it always is
+	std::shared_ptr<httplib::Response> get(const std::string& url, long long deadline, bool& late, bool& cacheHit,
+		const TileSink* sink = nullptr, const std::function<bool()>& giveUp = nullptr)
+	{
+		late = false;
+		uint64_t received = 0;
+		auto timer = TIME_NOW_EPOCH_MS;
+
+		httplib::Request req;
+		req.method = "GET";
+		req.path = url;
+		req.progress = [&](uint64_t current, uint64_t total)
+		{
+			received = current;
+			auto elapsed = TIME_NOW_EPOCH_MS - timer;
+			if (deadline == 0 || elapsed < MIN_PROGRESS_MS)
+				return true;
+
+			// end of transfer projected from the throughput seen so far
+			if (timer + elapsed * (double)total / current <= deadline)
+				return true;
+
+			if (giveUp && !giveUp())
+			{
+				deadline = 0;
+				return true;
+			}
+			late = true;
+			return false;
+		};
+		// chunked responses report no progress, the bytes are counted where they arrive
+		if (sink)
+			req.content_receiver = [&](const char* data, size_t len, uint64_t offset, uint64_t total)
+			{
+				received = std::max<uint64_t>(received, offset + len);
+				return sink->receive(data, len, offset, total);
+			};
+
+		auto res = std::make_shared<httplib::Response>();
+		double transferMsBefore;
+		{
+			std::lock_guard<std::mutex> l(downloadMtx);
+			transferMsBefore = transferMs(timer);
+			transfersInFlight++;
+		}
+		bool ok = httpClient->send(req, *res);
+		auto timerEnd = TIME_NOW_EPOCH_MS;
+		received = std::max<uint64_t>(received, res->body.size());
+
+		// aborted transfers still tell how fast the proxy or the origin delivered
+		cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+		{
+			std::lock_guard<std::mutex> l(downloadMtx);
+			double concurrency = (transferMs(timerEnd) - transferMsBefore) / std::max<long long>(1, timerEnd - timer);
+			transfersInFlight--;
+			if (received > 0)
+				(cacheHit ? hitEstimator : estimator)->addSample({ timer, timerEnd, received, concurrency });
+		}
+
+		// an error page must not end up in the decoder
+		return ok && res->status >= 200 && res->status < 300 ? res : nullptr;
+	}
+
+	// expected transfer time of a segment in the given qualities, as bytes at origin throughput
+	size_t bandwidthNeededForTileQuality(const std::vector<int>& quality) const
+	{
+		int numQualities = mpd->period.adaptationSets[0].representations.size();
+		double neededBandwidth = 0;
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
+			neededBandwidth += transferCost[i * numQualities + quality[i]];
+		return neededBandwidth;
+	}
+
+	// writes the viewport samples per tile of the predicted head rotations to tileVisibility
+	void predictTileVisibility(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment)
+	{
+		std::fill(tileVisibility.begin(), tileVisibility.end(), 0);
 
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			visibilityTable.accumulate(headRotations[0].second, tileVisibility);
+		}
+		else if (Config::instance()->viewportInstants > 0)
+		{
+			predictTileProbability(headRotations, segment);
+		}
+		else if (Config::instance()->headPrediction == Config::HeadPrediction::Quaternion)
+		{
+			auto timestamp = headRotations[0].first;
+			double segmentDurationMs = mpd->segmentDuration() * 1000;
+
+			for (double ahead : { 0.5, 1.0 })
+				visibilityTable.accumulate(headPredictor.predict(headRotations, timestamp + ahead * segmentDurationMs), tileVisibility);
 		}
 		else
 		{
-			// convert quaternions to euler angles
-			std::vector<double> timeVector(headRotations.size());
-			std::vector<double> rollVector(headRotations.size());
-			std::vector<double> pitchVector(headRotations.size());
-			std::vector<double> yawVector(headRotations.size());
+			// regress euler angles over time
+			Regression funRegressionRoll, funRegressionPitch, funRegressionYaw;
 			for (int i = 0; i < headRotations.size(); i++)
 			{
 				auto eulerAngle = headRotations[i].second.ToEuler();
-				timeVector[i] = headRotations[i].first;
-				rollVector[i] = eulerAngle.GetX();
-				pitchVector[i] = eulerAngle.GetY();
-				yawVector[i] = eulerAngle.GetZ();
+				double time = headRotations[i].first;
+				funRegressionRoll.add(time, eulerAngle.GetX());
+				funRegressionPitch.add(time, eulerAngle.GetY());
+				funRegressionYaw.add(time, eulerAngle.GetZ());
 			}
 
-			auto funRegressionRoll = computeRegressionFunction(timeVector, rollVector);
-			auto funRegressionPitch = computeRegressionFunction(timeVector, pitchVector);
-			auto funRegressionYaw = computeRegressionFunction(timeVector, yawVector);
-
 			auto timestamp = headRotations[0].first;
 
 			static const double segmentDurationMs = mpd->segmentDuration() * 1000;
@@ -330,17 +892,82 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				visibilityTable.accumulate(rot, tileVisibility);
 			}
 		}
+	}
 
-		// convert to vector
-		std::vector<std::pair<int, int>> tileVisibility;
-		for (auto it = tileVisibilityMap.begin(); it != tileVisibilityMap.end(); it++)
-			tileVisibility.push_back(std::make_pair(it->second, it->first));
+	// Fills tileProbability for instants spread evenly over the display time of the segment. The
+	// predicted head rotation of an instant is blurred by a normal distribution of yaw and pitch whose
+	// deviation grows with how far ahead the instant lies, so neighbouring tiles get a share of the
+	// probability the more uncertain the prediction is. With crowdPrediction, the probabilities are
+	// blended with the crowd's viewing distribution of the segment, which weighs more the further ahead
+	// the instant lies. tileVisibility gets the expected visible ms.
+	void predictTileProbability(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment)
+	{
+		auto config = Config::instance();
+		int numInstants = config->viewportInstants;
+		int numTiles = tileVisibility.size();
+		double segmentDuration = mpd->segmentDuration();
+		auto timestamp = headRotations[0].first;
+
+		bool quaternion = config->headPrediction == Config::HeadPrediction::Quaternion;
+		Regression funRegressionRoll, funRegressionPitch, funRegressionYaw;
+		for (int i = 0; i < headRotations.size() && !quaternion; i++)
+		{
+			auto eulerAngle = headRotations[i].second.ToEuler();
+			double time = headRotations[i].first;
+			funRegressionRoll.add(time, eulerAngle.GetX());
+			funRegressionPitch.add(time, eulerAngle.GetY());
+			funRegressionYaw.add(time, eulerAngle.GetZ());
+		}
 
-		return tileVisibility;
+		// popularity ranks the tiles of a segment by the quality the crowd streamed them in,
+		// mapped to visibility as in the transition to popularity
+		auto popularity = mpd->period.segmentTilePopularity.find(segment);
+		bool crowd = config->crowdPrediction && popularity != mpd->period.segmentTilePopularity.end();
+		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
+		for (int t = 0; t < numTiles && crowd; t++)
+		{
+			auto it = popularity->second.find(t);
+			int quality = it != popularity->second.end() ? it->second : 0;
+			crowdVisibility[t] = lowq ? (lowq - quality) / (double)lowq : 0;
+		}
+
+		std::fill(tileProbability.begin(), tileProbability.end(), 0.0);
+		for (int k = 0; k < numInstants; k++)
+		{
+			// seconds from the newest head sample, the segment is displayed once the buffer has run out
+			double ahead = std::max(0.0, bufferLevel) + (k + 0.5) / numInstants * segmentDuration;
+			double ts = timestamp + ahead * 1000;
+			auto rotation = quaternion ? headPredictor.predict(headRotations, ts)
+				: Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
+			double deviation = (PREDICTION_DEVIATION_BASE + config->predictionUncertainty * ahead) * PI / 180.0;
+
+			auto probability = &tileProbability[k * numTiles];
+			for (auto& offset : viewportOffsets)
+			{
+				auto samples = visibilityTable.lookup(rotation * Quaternion::FromEuler(deviation * offset.first, deviation * offset.second, 0));
+				for (int t = 0; t < numTiles; t++)
+					if (samples[t])
+						probability[t] += 1.0 / viewportOffsets.size();
+			}
+
+			if (crowd)
+			{
+				double crowdWeight = 1 - std::exp(-ahead / config->crowdHorizon);
+				for (int t = 0; t < numTiles; t++)
+					probability[t] = (1 - crowdWeight) * probability[t] + crowdWeight * crowdVisibility[t];
+			}
+		}
+
+		for (int t = 0; t < numTiles; t++)
+		{
+			double visibleMs = 0;
+			for (int k = 0; k < numInstants; k++)
+				visibleMs += tileProbability[k * numTiles + t] * segmentDuration * 1000 / numInstants;
+			tileVisibility[t] = (int)std::lround(visibleMs);
+		}
 	}
 
 	int mapCoordToTile(NormalizedCoordinate coord) const
@@ -0,0 +1,99 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Debug counter of heap allocations per thread, enabled by defining
+	COUNT_ALLOCATIONS. The translation unit that also defines
+	ALLOCATION_COUNTER_MAIN before including this header replaces the
+	global operator new and delete. Paths that must not allocate assert so.
+*/
+
+#pragma once
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <cassert>
+
+namespace AllocationCounter
+{
+	// heap allocations of the calling thread so far
+	inline size_t& count()
+	{
+		static thread_local size_t allocations = 0;
+		return allocations;
+	}
+
+	// prints the allocations the calling thread made while the scope was alive, if any,
+	// and asserts there were none if mustNotAllocate is set
+	class Scope
+	{
+	public:
+		Scope(const char* name, bool mustNotAllocate = false) : name(name), start(count()), mustNotAllocate(mustNotAllocate) {}
+
+		~Scope()
+		{
+			size_t allocations = count() - start;
+			if (allocations)
+				std::cout << name << ": " << allocations << " heap allocations" << std::endl;
+			assert(!mustNotAllocate || allocations == 0);
+		}
+
+	protected:
+		const char* name;
+		size_t start;
+		bool mustNotAllocate;
+	};
+
+	// counts its allocations on its own, enclosing scopes do not see them
+	class SeparateScope : public Scope
+	{
+	public:
+		SeparateScope(const char* name) : Scope(name) {}
+
+		~SeparateScope()
+		{
+			// runs before ~Scope, which then finds the count it started with
+			size_t allocations = count() - start;
+			if (allocations)
+				std::cout << name << ": " << allocations << " heap allocations" << std::endl;
+			count() = start;
+		}
+	};
+}
+
+#ifdef ALLOCATION_COUNTER_MAIN
+// array new and delete forward to these
+void* operator new(std::size_t size)
+{
+	AllocationCounter::count()++;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+#endif
+
+#define COUNT_ALLOCATIONS_SCOPE(name) AllocationCounter::Scope allocationScope(name)
+#define COUNT_NO_ALLOCATIONS_SCOPE(name, condition) AllocationCounter::Scope allocationScope(name, condition)
+#define COUNT_ALLOCATIONS_SEPARATELY(name) AllocationCounter::SeparateScope separateAllocationScope(name)
+
+#else
+
+#define COUNT_ALLOCATIONS_SCOPE(name)
+#define COUNT_NO_ALLOCATIONS_SCOPE(name, condition)
+#define COUNT_ALLOCATIONS_SEPARATELY(name)
+
+#endif
@@ -0,0 +1,210 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Estimators of the available bandwidth. Every download that missed the
+	cache is added as a timestamped throughput sample, the adaptation reads
+	the estimate once per segment. The last estimate of a session can be
+	stored and used as the starting estimate of the next one.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+
+class BandwidthEstimator
+{
+public:
+	struct Sample
+	{
+		long long start;	// epoch ms
+		long long end;
+		size_t bytes;
+		double concurrency;	// transfers in flight on average while this one was, itself included
+	};
+
+	// initial is the estimate until the first sample arrives, in bytes per second
+	BandwidthEstimator(double initial) : current(initial) {}
+	virtual ~BandwidthEstimator() {}
+
+	virtual void addSample(const Sample& sample) = 0;
+
+	// bytes per second
+	virtual double estimate()
+	{
+		return current;
+	}
+
+	// "segment", "ewma", "harmonic" or "percentile", anything else is "segment"
+	static std::unique_ptr<BandwidthEstimator> create(const std::string& type, double initial);
+
+	// estimate stored by a previous session, fallback if there is none
+	static double load(const std::string& path, double fallback)
+	{
+		double estimate = 0;
+		std::ifstream file(path);
+		if (path.empty() || !(file >> estimate) || estimate <= 0)
+			return fallback;
+		return estimate;
+	}
+
+	static void store(const std::string& path, double estimate)
+	{
+		if (path.empty() || estimate <= 0)
+			return;
+		std::ofstream file(path, std::ios::trunc);
+		file << (size_t)estimate << std::endl;
+	}
+
+protected:
+	double current;
+
+	// throughput of a transfer, parallel transfers are assumed to share the link evenly
+	static double throughput(const Sample& sample)
+	{
+		return sample.bytes * 1000.0 / std::max(1LL, sample.end - sample.start) * std::max(1.0, sample.concurrency);
+	}
+};
+
+// Bytes over the time any transfer was in flight, since the last estimate.
+// Keeps the previous estimate if nothing was downloaded in between.
+class SegmentBandwidthEstimator : public BandwidthEstimator
+{
+public:
+	SegmentBandwidthEstimator(double initial) : BandwidthEstimator(initial), bytes(0) {}
+
+	void addSample(const Sample& sample) override
+	{
+		intervals.push_back({ sample.start, sample.end });
+		bytes += sample.bytes;
+	}
+
+	double estimate() override
+	{
+		// wall time during which at least one transfer was in flight,
+		// so parallel transfers are not counted twice
+		std::sort(intervals.begin(), intervals.end());
+		long long busy = 0;
+		long long coveredUntil = 0;
+		for (const auto& interval : intervals)
+		{
+			auto start = std::max(interval.first, coveredUntil);
+			if (interval.second > start)
+				busy += interval.second - start;
+			coveredUntil = std::max(coveredUntil, interval.second);
+		}
+
+		if (busy != 0 && bytes != 0)
+			current = bytes * (1000.0 / busy);
+
+		intervals.clear();
+		bytes = 0;
+		return current;
+	}
+
+private:
+	std::vector<std::pair<long long, long long>> intervals;
+	size_t bytes;
+};
+
+// Exponentially weighted moving average, a sample's weight grows with its duration
+class EwmaBandwidthEstimator : public BandwidthEstimator
+{
+public:
+	EwmaBandwidthEstimator(double initial, double halfLifeSeconds = 3.0)
+		: BandwidthEstimator(initial), halfLife(halfLifeSeconds), samples(0) {}
+
+	void addSample(const Sample& sample) override
+	{
+		double seconds = (sample.end - sample.start) / 1000.0;
+		double alpha = samples++ ? 1 - std::pow(0.5, seconds / halfLife) : 1;
+		current = alpha * throughput(sample) + (1 - alpha) * current;
+	}
+
+private:
+	double halfLife;
+	size_t samples;
+};
+
+// Harmonic mean of the last samples, which keeps short throughput peaks from dominating
+class HarmonicBandwidthEstimator : public BandwidthEstimator
+{
+public:
+	HarmonicBandwidthEstimator(double initial, size_t window = 20)
+		: BandwidthEstimator(initial), window(std::max<size_t>(1, window)), next(0)
+	{
+		samples.reserve(this->window);
+	}
+
+	void addSample(const Sample& sample) override
+	{
+		double t = throughput(sample);
+		if (t <= 0)
+			return;
+
+		if (samples.size() < window)
+			samples.push_back(t);
+		else
+			samples[next] = t;
+		next = (next + 1) % window;
+
+		double inverse = 0;
+		for (double s : samples)
+			inverse += 1 / s;
+		current = samples.size() / inverse;
+	}
+
+private:
+	size_t window;
+	size_t next;
+	std::vector<double> samples;
+};
+
+// Low percentile of the last samples, a conservative estimate on volatile links
+class PercentileBandwidthEstimator : public BandwidthEstimator
+{
+public:
+	PercentileBandwidthEstimator(double initial, double percentile = 0.2, size_t window = 40)
+		: BandwidthEstimator(initial), percentile(percentile), window(std::max<size_t>(1, window)), next(0)
+	{
+		samples.reserve(this->window);
+		sorted.reserve(this->window);
+	}
+
+	void addSample(const Sample& sample) override
+	{
+		if (samples.size() < window)
+			samples.push_back(throughput(sample));
+		else
+			samples[next] = throughput(sample);
+		next = (next + 1) % window;
+
+		sorted.assign(samples.begin(), samples.end());
+		auto nth = sorted.begin() + (size_t)(percentile * (sorted.size() - 1));
+		std::nth_element(sorted.begin(), nth, sorted.end());
+		current = *nth;
+	}
+
+private:
+	double percentile;
+	size_t window;
+	size_t next;
+	std::vector<double> samples;
+	std::vector<double> sorted;
+};
+
+inline std::unique_ptr<BandwidthEstimator> BandwidthEstimator::create(const std::string& type, double initial)
+{
+	if (type == "ewma")
+		return std::unique_ptr<BandwidthEstimator>(new EwmaBandwidthEstimator(initial));
+	if (type == "harmonic")
+		return std::unique_ptr<BandwidthEstimator>(new HarmonicBandwidthEstimator(initial));
+	if (type == "percentile")
+		return std::unique_ptr<BandwidthEstimator>(new PercentileBandwidthEstimator(initial));
+	return std::unique_ptr<BandwidthEstimator>(new SegmentBandwidthEstimator(initial));
+}
@@ -1,37 +1,46 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Fixed capacity ring, index 0 is the element pushed last.
+	Never allocates, the oldest element is overwritten once it is full.
 */
 
 #pragma once
 
 #include <stdexcept>
-#include <deque>
+#include <cstddef>
 
 template<typename T, size_t s = 40>
 class CircularBuffer
 {
 public:
-	CircularBuffer() { }
+	CircularBuffer() : newest(s - 1), count(0) { }
 
 	void push(const T& elem)
 	{
-		buf.push_front(elem);
-		while (buf.size() > s)
-			buf.pop_back();
+		newest = (newest + 1) % s;
+		buf[newest] = elem;
+		if (count < s)
+			count++;
 	}
 
 	const T& operator[](size_t index) const
 	{
-		if (index >= buf.size())
+		if (index >= count)
 			throw std::invalid_argument("CircularBuffer::operator[]: index exceeds bounds");
 		
-		return buf[index];
+		return buf[(newest + s - index) % s];
+	}
+
+	void clear()
+	{
+		count = 0;
 	}
 
 	int size() const
 	{
-		return buf.size();
+		return count;
 	}
 
 	size_t capacity() const
@@ -40,5 +49,7 @@ public:
 	}
 
 private:
-	std::deque<T> buf;
-};
\ No newline at end of file
+	T buf[s];
+	size_t newest;
+	size_t count;
+};
@@ -12,6 +12,8 @@ class Config
 {
 public:
 	enum class PlayType { Dash, Picture };
+	enum class Solver { Greedy, Knapsack };
+	enum class HeadPrediction { Regression, Quaternion };
 	void init(std::string path)
 	{
 		INIReader ini(path);
@@ -31,6 +33,29 @@ public:
 			demo = ini.GetBoolean(playConfig, "demo", false);
 			monitor = ini.GetBoolean(playConfig, "monitor", false);
 			monitorttf = ini.Get(playConfig, "monitorttf", "");
+			parallelDownloads = ini.GetInteger(playConfig, "parallelDownloads", 4);
+			keepAlive = ini.GetBoolean(playConfig, "keepAlive", true);
+			bufferSegments = std::max(1L, ini.GetInteger(playConfig, "bufferSegments", 1));
+			upgradeTiles = ini.GetBoolean(playConfig, "upgradeTiles", false);
+			initCache = ini.Get(playConfig, "initCache", "");
+			qualitySolver = ini.Get(playConfig, "qualitySolver", "greedy") == "knapsack" ? Solver::Knapsack : Solver::Greedy;
+			bandwidthEstimator = ini.Get(playConfig, "bandwidthEstimator", "segment");
+			bandwidthFile = ini.Get(playConfig, "bandwidthFile", "");
+			cacheAware = ini.GetBoolean(playConfig, "cacheAware", false);
+			mpc = ini.GetBoolean(playConfig, "mpc", false);
+			mpcHorizon = std::min(5L, std::max(1L, ini.GetInteger(playConfig, "mpcHorizon", 3)));
+			headPrediction = ini.Get(playConfig, "headPrediction", "regression") == "quaternion" ? HeadPrediction::Quaternion : HeadPrediction::Regression;
+			predictionDamping = ini.GetReal(playConfig, "predictionDamping", 0.0);
+			viewportInstants = std::max(0L, ini.GetInteger(playConfig, "viewportInstants", 0));
+			predictionUncertainty = ini.GetReal(playConfig, "predictionUncertainty", 13.0);
+			crowdPrediction = ini.GetBoolean(playConfig, "crowdPrediction", false);
+			crowdHorizon = ini.GetReal(playConfig, "crowdHorizon", 1.5);
+			decoderThreads = std::max(0L, ini.GetInteger(playConfig, "decoderThreads", 0));
+			// demo mode colors the tiles while composing the frame
+			tileUpload = ini.GetBoolean(playConfig, "tileUpload", false) && !demo;
+			// the crowd prior is blended per instant of the probabilistic prediction
+			if (crowdPrediction && viewportInstants == 0)
+				viewportInstants = 4;
 		}
 		else if (typeStr == "picture")
 		{
@@ -55,6 +80,25 @@ public:
 	bool demo;
 	bool monitor;
 	std::string monitorttf;
+	int parallelDownloads;
+	bool keepAlive;
+	int bufferSegments;
+	bool upgradeTiles;
+	std::string initCache;
+	Solver qualitySolver;
+	std::string bandwidthEstimator;
+	std::string bandwidthFile;
+	bool cacheAware;
+	bool mpc;
+	int mpcHorizon;
+	HeadPrediction headPrediction;
+	double predictionDamping;
+	int viewportInstants;
+	double predictionUncertainty;
+	bool crowdPrediction;
+	double crowdHorizon;
+	int decoderThreads;
+	bool tileUpload;
 
 	std::string imgPath;
 
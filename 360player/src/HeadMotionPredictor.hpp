@@ -0,0 +1,83 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Extrapolates head rotations on the rotation group. The rotations of the
+	history are expressed relative to the newest one as rotation vectors
+	(the quaternion logarithm), a line is fitted to them over time and followed
+	into the future, optionally with an exponentially decaying angular
+	velocity. Unlike lines fitted to Euler angles this does not break at the
+	yaw wraparound or near the poles.
+*/
+
+#pragma once
+
+#include <cmath>
+
+#include "Quaternion.hpp"
+
+class HeadMotionPredictor
+{
+public:
+	// windowMs: history used for the fit, damping: decay rate of the angular velocity in 1/s, 0 keeps it constant
+	HeadMotionPredictor(double windowMs = 250, double damping = 0)
+		: windowMs(windowMs), damping(damping) {}
+
+	// Rotation at timestamp when (ms). history holds (timestamp ms, rotation) pairs, newest first,
+	// as CircularBuffer does.
+	template <class History>
+	IMT::Quaternion predict(const History& history, double when) const
+	{
+		auto newest = history[0].second;
+		auto newestInv = newest.Inv();
+		double newestTime = history[0].first;
+
+		// least squares line r(t) = a + w t through the rotation vectors, t relative to the newest sample
+		double n = 0, s_t = 0, s_tt = 0;
+		IMT::VectorCartesian s_r(0, 0, 0), s_tr(0, 0, 0);
+		for (int i = 0; i < history.size(); i++)
+		{
+			double t = (history[i].first - newestTime) / 1000.0;
+			if (-t * 1000.0 > windowMs && i > 1)
+				break;
+
+			auto r = rotationVector(history[i].second * newestInv);
+			n++;
+			s_t += t;
+			s_tt += t * t;
+			s_r = s_r + r;
+			s_tr = s_tr + r * t;
+		}
+
+		double denominator = n * s_tt - s_t * s_t;
+		if (n < 2 || denominator <= 0)
+			return newest;
+
+		auto velocity = (s_tr * n - s_r * s_t) / denominator;
+		auto intercept = (s_r - velocity * s_t) / n;
+
+		double horizon = (when - newestTime) / 1000.0;
+		if (damping > 0)
+			horizon = (1 - std::exp(-damping * horizon)) / damping;
+
+		auto predicted = IMT::Quaternion::Exp(IMT::Quaternion(0, intercept + velocity * horizon)) * newest;
+		predicted.Normalize();
+		return predicted;
+	}
+
+private:
+	double windowMs;
+	double damping;
+
+	// half the rotation angle times the rotation axis, of the shorter of the two equivalent rotations
+	static IMT::VectorCartesian rotationVector(const IMT::Quaternion& q)
+	{
+		auto v = q.GetV();
+		double sine = v.Norm();
+		if (sine == 0)
+			return v;
+		// atan2 stays accurate for small angles where acos of w does not
+		double halfAngle = std::atan2(sine, std::abs(q.GetW()));
+		return v * ((q.GetW() < 0 ? -halfAngle : halfAngle) / sine);
+	}
+};
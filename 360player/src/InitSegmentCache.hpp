@@ -0,0 +1,101 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	On-disk cache of initialization segments. Entries are named after a hash of
+	the MPD URL, the MPD document and the init URL, so a changed MPD never hits
+	stale entries.
+*/
+
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include <experimental/filesystem>
+
+class InitSegmentCache
+{
+public:
+	// an empty directory disables the cache
+	InitSegmentCache(const std::string& dir, const std::string& mpdUri, const std::string& mpd)
+		: dir(dir), mpdKey(mpdUri + '\n' + hex(hash(mpd)) + '\n')
+	{
+		std::error_code ec;
+		if (!dir.empty())
+			std::experimental::filesystem::create_directories(dir, ec);
+	}
+
+	bool enabled() const
+	{
+		return !dir.empty();
+	}
+
+	bool get(const std::string& initUrl, std::string& data) const
+	{
+		if (!enabled())
+			return false;
+
+		std::ifstream file(path(initUrl), std::ios::binary);
+		if (!file)
+			return false;
+
+		std::ostringstream ss;
+		ss << file.rdbuf();
+		data = ss.str();
+		return !data.empty();
+	}
+
+	// concurrent writers of the same entry are fine, each renames a complete file into place
+	void put(const std::string& initUrl, const std::string& data) const
+	{
+		if (!enabled() || data.empty())
+			return;
+
+		auto target = path(initUrl);
+		auto tmp = target;
+		tmp += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+			if (!file.write(data.data(), data.size()))
+				return;
+		}
+
+		std::error_code ec;
+		std::experimental::filesystem::rename(tmp, target, ec);
+		if (ec)
+			std::experimental::filesystem::remove(tmp, ec);
+	}
+
+private:
+	std::string dir;
+	std::string mpdKey;
+
+	std::experimental::filesystem::path path(const std::string& initUrl) const
+	{
+		return std::experimental::filesystem::path(dir) / (hex(hash(mpdKey + initUrl)) + ".mp4");
+	}
+
+	// FNV-1a
+	static uint64_t hash(const std::string& s)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (unsigned char c : s)
+		{
+			h ^= c;
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static std::string hex(uint64_t v)
+	{
+		std::ostringstream ss;
+		ss << std::hex << std::setw(16) << std::setfill('0') << v;
+		return ss.str();
+	}
+};
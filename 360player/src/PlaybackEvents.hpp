@@ -0,0 +1,94 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Playback position and head sample events published by the render thread.
+	Waiters name the value they need and are only woken once it is reached.
+	Publishing only stores the value, the lock is taken and waiters notified
+	once a registered target has been reached.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <algorithm>
+
+class PlaybackEvents
+{
+public:
+	PlaybackEvents() {}
+
+	PlaybackEvents(const PlaybackEvents&) = delete;
+	PlaybackEvents& operator=(const PlaybackEvents&) = delete;
+
+	// number of head rotation samples recorded so far
+	void publishHeadSamples(size_t samples)
+	{
+		publish(headSamples, samples);
+	}
+
+	// last frame shown on the display
+	void publishFrame(size_t frame)
+	{
+		publish(displayed, frame);
+	}
+
+	size_t waitForHeadSamples(size_t samples)
+	{
+		return waitFor(headSamples, samples);
+	}
+
+	// returns the displayed frame once it is at least frame
+	size_t waitForFrame(size_t frame)
+	{
+		return waitFor(displayed, frame);
+	}
+
+	size_t displayedFrame() const
+	{
+		return displayed.value.load();
+	}
+
+private:
+	struct counter
+	{
+		std::atomic<size_t> value{ 0 };
+		std::atomic<size_t> target{ SIZE_MAX };
+	};
+
+	counter headSamples;
+	counter displayed;
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+
+	void publish(counter& c, size_t value)
+	{
+		// sequentially consistent with waitFor: either the waiter sees the value or we see its target
+		c.value.store(value);
+		if (value < c.target.load())
+			return;
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			if (value >= c.target.load())
+				c.target.store(SIZE_MAX);
+		}
+		cv.notify_all();
+	}
+
+	size_t waitFor(counter& c, size_t value)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		// the target is cleared whenever it is reached, so every waiter registers again
+		while (c.value.load() < value)
+		{
+			c.target.store(std::min(c.target.load(), value));
+			if (c.value.load() >= value)
+				break;
+			cv.wait(lock);
+		}
+		return c.value.load();
+	}
+};
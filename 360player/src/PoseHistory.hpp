@@ -0,0 +1,134 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Head rotation history written by the render thread and read by the
+	adaptation. push never blocks or allocates. Readers copy a consistent
+	snapshot and retry while a push overlaps (sequence lock). The samples are
+	stored in relaxed atomics, so a read that overlaps a push and is thrown
+	away is not a data race.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <climits>
+#include <algorithm>
+
+#include "Quaternion.hpp"
+#include "CircularBuffer.hpp"
+
+template<size_t Capacity = 40>
+class PoseHistory
+{
+public:
+	typedef std::pair<long long, IMT::Quaternion> Pose;
+	// newest first, as the adaptation takes it
+	typedef CircularBuffer<Pose, Capacity> Snapshot;
+
+	PoseHistory() : sequence(0), pushed(0) {}
+
+	PoseHistory(const PoseHistory&) = delete;
+	PoseHistory& operator=(const PoseHistory&) = delete;
+
+	// only called by the one writing thread
+	void push(long long timestamp, const IMT::Quaternion& rotation)
+	{
+		size_t n = pushed.load(std::memory_order_relaxed);
+		auto& slot = slots[n % Capacity];
+
+		unsigned s = sequence.load(std::memory_order_relaxed);
+		sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.timestamp.store(timestamp, std::memory_order_relaxed);
+		slot.w.store(rotation.GetW(), std::memory_order_relaxed);
+		slot.x.store(rotation.GetV().GetX(), std::memory_order_relaxed);
+		slot.y.store(rotation.GetV().GetY(), std::memory_order_relaxed);
+		slot.z.store(rotation.GetV().GetZ(), std::memory_order_relaxed);
+		pushed.store(n + 1, std::memory_order_relaxed);
+
+		sequence.store(s + 2, std::memory_order_release);
+	}
+
+	// Copies the poses not older than windowMs before the newest one to snapshot, all if windowMs is 0
+	void snapshot(Snapshot& snapshot, long long windowMs = 0) const
+	{
+		read([&]
+		{
+			snapshot.clear();
+			size_t n = pushed.load(std::memory_order_relaxed);
+			size_t available = std::min(n, Capacity);
+			if (available == 0)
+				return;
+
+			long long from = windowMs ? load(n - 1).first - windowMs : LLONG_MIN;
+			for (size_t i = n - available; i < n; i++)
+			{
+				auto pose = load(i);
+				if (pose.first >= from)
+					snapshot.push(pose);
+			}
+		});
+	}
+
+	// newest pose, call once something has been pushed
+	Pose latest() const
+	{
+		Pose pose;
+		read([&] { pose = load(pushed.load(std::memory_order_relaxed) - 1); });
+		return pose;
+	}
+
+	// poses pushed so far, including the ones overwritten since
+	size_t count() const
+	{
+		return pushed.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return Capacity;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<long long> timestamp;
+		std::atomic<double> w, x, y, z;
+	};
+
+	Slot slots[Capacity];
+	std::atomic<unsigned> sequence;
+	std::atomic<size_t> pushed;
+
+	Pose load(size_t index) const
+	{
+		auto& slot = slots[index % Capacity];
+		return { slot.timestamp.load(std::memory_order_relaxed), IMT::Quaternion(slot.w.load(std::memory_order_relaxed),
+			slot.x.load(std::memory_order_relaxed), slot.y.load(std::memory_order_relaxed), slot.z.load(std::memory_order_relaxed)) };
+	}
+
+	// runs copy until no push overlapped it
+	template<typename Copy>
+	void read(const Copy& copy) const
+	{
+		while (true)
+		{
+			unsigned before = sequence.load(std::memory_order_acquire);
+			if (before & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			copy();
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == before)
+				return;
+		}
+	}
+};
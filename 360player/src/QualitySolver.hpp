@@ -0,0 +1,228 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Chooses one representation per tile so that the visibility weighted
+	utility is maximized while the summed bitrate stays within a budget
+	(multiple-choice knapsack). Solved through the Lagrangian relaxation:
+	upgrades along the concave hull of each tile's (bitrate, utility) points
+	are taken in order of utility per byte, then remaining budget is filled
+	with the best single upgrade per tile that still fits. The same is tried
+	once more starting with the first upgrade that did not fit.
+	Utility of a representation is the log of its bitrate over the lowest one.
+	The cost of a representation defaults to its bitrate and may be replaced
+	before each solve, e.g. by its expected transfer time.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+class QualitySolver
+{
+public:
+	// bitrate(tile, quality) of each representation, quality 0 being the highest
+	QualitySolver(int numTiles, int numQualities, const std::function<double(int tile, int quality)>& bitrate)
+		: numTiles(numTiles), numQualities(numQualities)
+		, cost(numTiles * numQualities), utility(numTiles * numQualities), hullBegin(numTiles + 1)
+	{
+		int lowq = numQualities - 1;
+		for (int t = 0; t < numTiles; t++)
+		{
+			for (int q = 0; q < numQualities; q++)
+			{
+				cost[t * numQualities + q] = bitrate(t, q);
+				utility[t * numQualities + q] = std::log(bitrate(t, q) / bitrate(t, lowq));
+			}
+		}
+
+		hull.reserve(cost.size());
+		steps.reserve(cost.size());
+		byCost.resize(numQualities);
+		order.resize(numTiles);
+		alternative.resize(numTiles);
+		buildHull();
+	}
+
+	// Replaces the cost of every representation by cost(tile, quality), utilities stay.
+	// Does not allocate.
+	template <class Cost>
+	void setCost(const Cost& cost)
+	{
+		for (int t = 0; t < numTiles; t++)
+			for (int q = 0; q < numQualities; q++)
+				this->cost[t * numQualities + q] = cost(t, q);
+		buildHull();
+	}
+
+	// Writes the chosen quality of each tile to quality. Tiles of weight 0 stay in the lowest quality,
+	// the others start from their cheapest one, which is taken even if it exceeds the budget.
+	// Returns the summed cost.
+	double solve(const std::vector<double>& weight, double budget, std::vector<int>& quality)
+	{
+		// hull upgrades of all tiles by decreasing utility per byte
+		steps.clear();
+		for (int t = 0; t < numTiles; t++)
+		{
+			if (weight[t] <= 0)
+				continue;
+			for (size_t h = hullBegin[t] + 1; h < hullBegin[t + 1]; h++)
+				steps.push_back({ t, hull[h - 1], hull[h], weight[t] * slope(t, hull[h - 1], hull[h]) });
+		}
+		std::sort(steps.begin(), steps.end(), [](const Step& s1, const Step& s2)
+			{ return s1.efficiency != s2.efficiency ? s1.efficiency > s2.efficiency : s1.tile < s2.tile; });
+
+		for (int t = 0; t < numTiles; t++)
+			order[t] = t;
+		std::sort(order.begin(), order.end(), [&](int t1, int t2)
+			{ return weight[t1] != weight[t2] ? weight[t1] > weight[t2] : t1 < t2; });
+
+		const Step* critical = nullptr;
+		double used = greedy(weight, budget, nullptr, quality, critical);
+
+		// Efficient small upgrades can use up a tight budget that one large upgrade would
+		// use better, so also try starting from the first upgrade that did not fit
+		if (critical)
+		{
+			const Step* ignored;
+			double usedAlternative = greedy(weight, budget, critical, alternative, ignored);
+			if (usedAlternative <= budget && value(weight, alternative) > value(weight, quality))
+			{
+				std::copy(alternative.begin(), alternative.end(), quality.begin());
+				used = usedAlternative;
+			}
+		}
+
+		return used;
+	}
+
+	// visibility weighted utility of the given qualities
+	double value(const std::vector<double>& weight, const std::vector<int>& quality) const
+	{
+		double v = 0;
+		for (int t = 0; t < numTiles; t++)
+			v += weight[t] * at(utility, t, quality[t]);
+		return v;
+	}
+
+private:
+	struct Step
+	{
+		int tile;
+		int from;
+		int to;
+		double efficiency;
+	};
+
+	int numTiles;
+	int numQualities;
+	std::vector<double> cost;
+	std::vector<double> utility;
+	// hull qualities of tile t are hull[hullBegin[t]] to hull[hullBegin[t + 1] - 1], lowest first
+	std::vector<int> hull;
+	std::vector<size_t> hullBegin;
+	std::vector<int> byCost;
+	std::vector<Step> steps;
+	std::vector<int> order;
+	std::vector<int> alternative;
+
+	// Upper concave hull of each tile's (cost, utility) points, from its cheapest representation upwards
+	void buildHull()
+	{
+		hull.clear();
+		for (int t = 0; t < numTiles; t++)
+		{
+			// a cached representation can be cheaper than a lower quality one
+			for (int q = 0; q < numQualities; q++)
+				byCost[q] = q;
+			std::sort(byCost.begin(), byCost.end(), [&](int q1, int q2)
+				{ return at(cost, t, q1) != at(cost, t, q2) ? at(cost, t, q1) < at(cost, t, q2) : at(utility, t, q1) > at(utility, t, q2); });
+
+			hullBegin[t] = hull.size();
+			hull.push_back(byCost[0]);
+			for (int i = 1; i < numQualities; i++)
+			{
+				int q = byCost[i];
+
+				// a representation that costs more but is not better never pays off
+				if (at(utility, t, q) <= at(utility, t, hull.back()) || at(cost, t, q) <= at(cost, t, hull.back()))
+					continue;
+
+				while (hull.size() - hullBegin[t] >= 2 &&
+					slope(t, hull[hull.size() - 2], hull.back()) <= slope(t, hull.back(), q))
+					hull.pop_back();
+				hull.push_back(q);
+			}
+		}
+		hullBegin[numTiles] = hull.size();
+	}
+
+	// Takes the hull steps that fit, starting with first if given, then fills the remaining
+	// budget with the best single upgrade per tile. critical is the first step that did not fit.
+	double greedy(const std::vector<double>& weight, double budget, const Step* first, std::vector<int>& quality, const Step*& critical) const
+	{
+		int lowq = numQualities - 1;
+		double used = 0;
+		for (int t = 0; t < numTiles; t++)
+		{
+			quality[t] = weight[t] > 0 ? hull[hullBegin[t]] : lowq;
+			used += at(cost, t, quality[t]);
+		}
+
+		if (first)
+		{
+			used += at(cost, first->tile, first->to) - at(cost, first->tile, quality[first->tile]);
+			quality[first->tile] = first->to;
+		}
+
+		critical = nullptr;
+		for (auto& step : steps)
+		{
+			// an earlier step of this tile did not fit
+			if (quality[step.tile] != step.from)
+				continue;
+
+			double extra = at(cost, step.tile, step.to) - at(cost, step.tile, step.from);
+			if (used + extra <= budget)
+			{
+				quality[step.tile] = step.to;
+				used += extra;
+			}
+			else if (!critical)
+				critical = &step;
+		}
+
+		// spend what is left on the most visible tiles first
+		for (int t : order)
+		{
+			if (weight[t] <= 0)
+				break;
+			for (int q = 0; q < quality[t]; q++)
+			{
+				double extra = at(cost, t, q) - at(cost, t, quality[t]);
+				if (at(utility, t, q) > at(utility, t, quality[t]) && used + extra <= budget)
+				{
+					quality[t] = q;
+					used += extra;
+					break;
+				}
+			}
+		}
+
+		return used;
+	}
+
+	double at(const std::vector<double>& v, int tile, int quality) const
+	{
+		return v[tile * numQualities + quality];
+	}
+
+	// utility per byte of upgrading tile from quality q1 to q2
+	double slope(int tile, int q1, int q2) const
+	{
+		return (at(utility, tile, q2) - at(utility, tile, q1)) / (at(cost, tile, q2) - at(cost, tile, q1));
+	}
+};
@@ -111,6 +111,18 @@ public:
 		return std::move(frameInfo);
 	}
 
+	// with tile upload, tiles not marked visible are not uploaded
+	void setVisibleTiles(const std::vector<char>& visible)
+	{
+		m_videoReader.SetVisibleTiles(visible);
+	}
+
+	// decoded frames waiting to be displayed
+	size_t bufferedFrames() const
+	{
+		return m_videoReader.GetNbBufferedFrames();
+	}
+
 private:
 	LibAv::VideoReader m_videoReader;
 
@@ -0,0 +1,206 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Worker pool that downloads tiles with a bounded number of requests in flight.
+	Requests of all segments share one queue ordered by rank, so a visible tile
+	of a later segment may overtake a hidden tile of an earlier one.
+*/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+#include "AdaptionUnit.hpp"
+
+class TileFetcher
+{
+public:
+	typedef std::function<void(const AdaptionUnit::TileDownload& download)> TileHandler;
+	// a download that is not a tile of a segment, e.g. an init segment
+	typedef std::function<void()> Task;
+
+	TileFetcher(AdaptionUnit* au, int numWorkers)
+		: au(au), sequence(0), stopped(false)
+	{
+		numWorkers = std::max(1, numWorkers);
+		for (int i = 0; i < numWorkers; i++)
+			workers.emplace_back(&TileFetcher::run, this);
+	}
+
+	TileFetcher(const TileFetcher&) = delete;
+	TileFetcher& operator=(const TileFetcher&) = delete;
+
+	~TileFetcher()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			stopped = true;
+		}
+		jobCv.notify_all();
+		for (auto& w : workers)
+			w.join();
+	}
+
+	// Queues tile requests and returns immediately. handler is called from a worker thread
+	// as soon as a tile has arrived. If sinks are given (indexed by tile) the bodies are
+	// streamed into them while downloading.
+	void submit(const std::vector<AdaptionUnit::TileRequest>& requests, const TileHandler& handler,
+		const std::vector<AdaptionUnit::TileSink>* sinks = nullptr)
+	{
+		enqueue(requests, handler, sinks, nullptr);
+	}
+
+	// Same as submit, but returns once every one of the requests has been handled
+	void fetch(const std::vector<AdaptionUnit::TileRequest>& requests, const TileHandler& handler,
+		const std::vector<AdaptionUnit::TileSink>* sinks = nullptr)
+	{
+		auto batch = std::make_shared<size_t>(requests.size());
+		enqueue(requests, handler, sinks, batch);
+
+		std::unique_lock<std::mutex> lock(mtx);
+		doneCv.wait(lock, [&] { return *batch == 0; });
+	}
+
+	// Same as fetch, but also runs tasks on the workers in the same batch. They are queued
+	// ahead of the requests and ranked like the most urgent one, so both are in flight together.
+	void fetch(const std::vector<AdaptionUnit::TileRequest>& requests, const TileHandler& handler,
+		const std::vector<Task>& tasks)
+	{
+		auto batch = std::make_shared<size_t>(requests.size() + tasks.size());
+		AdaptionUnit::TileRequest urgent = {};
+		if (!requests.empty())
+			urgent = *std::min_element(requests.begin(), requests.end(), [](const AdaptionUnit::TileRequest& r1, const AdaptionUnit::TileRequest& r2)
+				{ return r1.rank < r2.rank; });
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			for (auto& task : tasks)
+			{
+				jobs.push({ urgent, sequence++, nullptr, nullptr, batch, std::make_shared<Task>(task) });
+				pendingSegments[urgent.segment]++;
+			}
+		}
+		enqueue(requests, handler, nullptr, batch);
+
+		std::unique_lock<std::mutex> lock(mtx);
+		doneCv.wait(lock, [&] { return *batch == 0; });
+	}
+
+	// Returns once no request of the segment or an earlier one is pending
+	void wait(int segment)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		doneCv.wait(lock, [&] { return pendingSegments.empty() || pendingSegments.begin()->first > segment; });
+	}
+
+	// Returns once no request is queued or in flight, false if that takes longer than timeout
+	bool waitIdle(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		return doneCv.wait_for(lock, timeout, [&] { return pendingSegments.empty(); });
+	}
+
+	// number of requests queued or in flight
+	size_t pending() const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		size_t n = 0;
+		for (auto& p : pendingSegments)
+			n += p.second;
+		return n;
+	}
+
+	int numWorkers() const
+	{
+		return workers.size();
+	}
+
+private:
+	struct Job
+	{
+		AdaptionUnit::TileRequest request;
+		size_t sequence;
+		std::shared_ptr<TileHandler> handler;
+		std::shared_ptr<AdaptionUnit::TileSink> sink;
+		std::shared_ptr<size_t> batch;
+		std::shared_ptr<Task> task;	// run instead of downloading request if set
+	};
+
+	// priority_queue keeps the greatest element on top: the lowest rank, then the oldest
+	struct JobOrder
+	{
+		bool operator()(const Job& j1, const Job& j2) const
+		{
+			if (j1.request.rank != j2.request.rank)
+				return j1.request.rank > j2.request.rank;
+			return j1.sequence > j2.sequence;
+		}
+	};
+
+	AdaptionUnit* au;
+	std::vector<std::thread> workers;
+	std::priority_queue<Job, std::vector<Job>, JobOrder> jobs;
+	std::map<int, size_t> pendingSegments;
+	size_t sequence;
+	bool stopped;
+	mutable std::mutex mtx;
+	std::condition_variable jobCv;
+	std::condition_variable doneCv;
+
+	void enqueue(const std::vector<AdaptionUnit::TileRequest>& requests, const TileHandler& handler,
+		const std::vector<AdaptionUnit::TileSink>* sinks, const std::shared_ptr<size_t>& batch)
+	{
+		auto sharedHandler = std::make_shared<TileHandler>(handler);
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			for (auto& request : requests)
+			{
+				std::shared_ptr<AdaptionUnit::TileSink> sink;
+				if (sinks)
+					sink = std::make_shared<AdaptionUnit::TileSink>(sinks->at(request.tile));
+				jobs.push({ request, sequence++, sharedHandler, sink, batch });
+				pendingSegments[request.segment]++;
+			}
+		}
+		jobCv.notify_all();
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				jobCv.wait(lock, [this] { return stopped || !jobs.empty(); });
+				if (stopped)
+					return;
+				job = jobs.top();
+				jobs.pop();
+			}
+
+			if (job.task)
+				(*job.task)();
+			else
+				(*job.handler)(au->download(job.request, job.sink.get()));
+
+			{
+				std::lock_guard<std::mutex> l(mtx);
+				if (--pendingSegments[job.request.segment] == 0)
+					pendingSegments.erase(job.request.segment);
+				if (job.batch)
+					--*job.batch;
+			}
+			doneCv.notify_all();
+		}
+	}
+};
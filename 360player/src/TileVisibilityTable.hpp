@@ -0,0 +1,178 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Lookup table from head orientation to the number of viewport samples
+	falling on each tile. Orientations are quantized by yaw, pitch and roll,
+	a cell is computed the first time it is looked up and then kept.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Quaternion.hpp"
+
+class TileVisibilityTable
+{
+public:
+	// writes the tile covered by each viewport sample when the head is rotated by rotation
+	typedef std::function<void(const IMT::Quaternion& rotation, int* tiles)> ProjectViewport;
+
+	// Default resolution (2 degrees yaw/pitch, 10 degrees roll) takes about 0.6 MB plus 1.2 MB per tile
+	TileVisibilityTable(int numTiles, int numSamples, const ProjectViewport& projectViewport,
+		double stepDegrees = 2.0, double rollStepDegrees = 10.0)
+		: numTiles(numTiles), numSamples(numSamples), projectViewport(projectViewport)
+		, yawSteps(std::max(1, (int)std::ceil(360.0 / stepDegrees)))
+		, pitchSteps(std::max(1, (int)std::ceil(180.0 / stepDegrees)))
+		, rollSteps(std::max(1, (int)std::ceil(360.0 / rollStepDegrees)))
+	{
+		if (numSamples > UINT16_MAX)
+			throw std::invalid_argument("TileVisibilityTable: too many samples per viewport");
+
+		size_t cells = (size_t)yawSteps * pitchSteps * rollSteps;
+		state.reset(new std::atomic<uint8_t>[cells]);
+		for (size_t i = 0; i < cells; i++)
+			state[i].store(EMPTY, std::memory_order_relaxed);
+		counts.reset(new uint16_t[cells * numTiles]);
+		scratch.reset(new int[numSamples]);
+		for (auto& m : missed)
+			m.store(NO_CELL, std::memory_order_relaxed);
+	}
+
+	TileVisibilityTable(const TileVisibilityTable&) = delete;
+	TileVisibilityTable& operator=(const TileVisibilityTable&) = delete;
+
+	// Samples per tile (numTiles entries) of the viewport at rotation.
+	// Safe to call from several threads.
+	const uint16_t* lookup(const IMT::Quaternion& rotation) const
+	{
+		return lookup(cellOf(rotation));
+	}
+
+	// Like lookup, but returns nullptr instead of filling a cell or waiting for it.
+	// The missed cell is remembered and filled by the next fillMissed.
+	const uint16_t* find(const IMT::Quaternion& rotation) const
+	{
+		size_t cell = cellOf(rotation);
+		if (state[cell].load(std::memory_order_acquire) == READY)
+			return &counts[cell * numTiles];
+
+		missed[nextMiss.fetch_add(1, std::memory_order_relaxed) % MISSED_CELLS].store(cell, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	// Fills the cells find has missed since the last call
+	void fillMissed() const
+	{
+		for (auto& m : missed)
+		{
+			size_t cell = m.exchange(NO_CELL, std::memory_order_relaxed);
+			if (cell != NO_CELL)
+				lookup(cell);
+		}
+	}
+
+	// Adds the samples of the viewport at rotation to tileVisibility[tile],
+	// tiles outside of the viewport are not touched
+	template<typename Map>
+	void accumulate(const IMT::Quaternion& rotation, Map& tileVisibility) const
+	{
+		auto c = lookup(rotation);
+		for (int t = 0; t < numTiles; t++)
+			if (c[t])
+				tileVisibility[t] += c[t];
+	}
+
+	int tiles() const
+	{
+		return numTiles;
+	}
+
+private:
+	enum : uint8_t { EMPTY, FILLING, READY };
+	static constexpr double PI = 3.141592653589793238462643383279502884;
+	// misses remembered between two fillMissed, older ones are overwritten
+	static constexpr size_t MISSED_CELLS = 16;
+	static constexpr size_t NO_CELL = SIZE_MAX;
+
+	int numTiles;
+	int numSamples;
+	ProjectViewport projectViewport;
+	int yawSteps;
+	int pitchSteps;
+	int rollSteps;
+	std::unique_ptr<std::atomic<uint8_t>[]> state;
+	std::unique_ptr<uint16_t[]> counts;
+	// tile of each viewport sample, shared by all fills
+	std::unique_ptr<int[]> scratch;
+	mutable std::mutex scratchLock;
+	mutable std::atomic<size_t> missed[MISSED_CELLS];
+	mutable std::atomic<size_t> nextMiss{ 0 };
+
+	size_t cellOf(const IMT::Quaternion& rotation) const
+	{
+		auto euler = rotation.ToEuler();
+		return (bin(euler.GetZ() + PI, 2 * PI, yawSteps) * (size_t)pitchSteps
+			+ bin(euler.GetY() + PI / 2, PI, pitchSteps)) * rollSteps
+			+ bin(euler.GetX() + PI, 2 * PI, rollSteps);
+	}
+
+	const uint16_t* lookup(size_t cell) const
+	{
+		auto& s = state[cell];
+		if (s.load(std::memory_order_acquire) != READY)
+		{
+			uint8_t expected = EMPTY;
+			if (s.compare_exchange_strong(expected, FILLING, std::memory_order_acq_rel))
+			{
+				fill(cell);
+				s.store(READY, std::memory_order_release);
+			}
+			else
+			{
+				while (s.load(std::memory_order_acquire) != READY)
+					std::this_thread::yield();
+			}
+		}
+
+		return &counts[cell * numTiles];
+	}
+
+	static int bin(double angle, double range, int steps)
+	{
+		return std::min(steps - 1, std::max(0, (int)(angle / range * steps)));
+	}
+
+	static double center(int bin, double range, int steps)
+	{
+		return (bin + 0.5) * range / steps;
+	}
+
+	void fill(size_t cell) const
+	{
+		int roll = cell % rollSteps;
+		int pitch = cell / rollSteps % pitchSteps;
+		int yaw = cell / rollSteps / pitchSteps;
+
+		auto rotation = IMT::Quaternion::FromEuler(center(yaw, 2 * PI, yawSteps) - PI,
+			center(pitch, PI, pitchSteps) - PI / 2, center(roll, 2 * PI, rollSteps) - PI);
+
+		// cells are filled rarely, so fills of different cells simply take turns on the scratch buffer
+		std::lock_guard<std::mutex> locker(scratchLock);
+		projectViewport(rotation, scratch.get());
+
+		auto c = &counts[cell * numTiles];
+		std::fill(c, c + numTiles, 0);
+		for (int i = 0; i < numSamples; i++)
+			c[scratch[i]]++;
+	}
+};
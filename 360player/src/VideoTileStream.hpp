@@ -1,13 +1,28 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Input of one tile's decoder: the tile's segments in index order. A segment
+	is a chain of refcounted buffers that are only ever appended to, so whole
+	downloaded bodies are taken over without copying and data streamed in is
+	never moved once written. A segment is released as soon as the decoder
+	has moved on to the next one.
 */
 
 #ifndef VIDEOSEGMENTSTREAM_HPP
 #define VIDEOSEGMENTSTREAM_HPP
 
 #include "IStream.hpp"
-#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
 #include "mpd.h"
 
 #define DEBUGVSS 0
@@ -23,16 +38,17 @@ public:
 	VideoTileStream()
 	{
 		swappedSize = 0;
-		swapReady = false;
-		done = false;
+		nextSegment = 0;
+		lastSegment = INT_MAX;
 	}
 
-	void init(const DASH::SRD& srd, const std::string& init, const std::string& firstSegment)
+	void init(const DASH::SRD& srd, std::string init, std::string firstSegment)
 	{
 		this->srd = srd;
-		ss1 = stream(init);
-		ss1.append(firstSegment);
-		activeStream = &ss1;
+		auto first = std::make_shared<segment>(std::move(init));
+		first->add(std::move(firstSegment));
+		activeStream = stream(0, first);
+		nextSegment = 1;
 	}
 
 	const DASH::SRD& getSRD() const
@@ -40,157 +56,296 @@ public:
 		return srd;
 	}
 
-	void addSegment(const std::string& segment, bool last = false)
+	// Queues a segment for the decoder. Segments are handed over in index order,
+	// so they may arrive in any order.
+	void addSegment(int segment, std::string data, bool last = false)
 	{
 		std::lock_guard<std::mutex> l(mtx);
 
-		if (activeStream == &ss1)
-		{
-			PRINT_DEBUG_VSS("append to s2");
-			ss2.append(segment);
-		}
-		else
-		{
-			PRINT_DEBUG_VSS("append to s1");
-			ss1.append(segment);
-		}
+		PRINT_DEBUG_VSS("add segment " << segment);
+		pendingSegments[segment] = std::make_shared<VideoTileStream::segment>(std::move(data));
+		if (last)
+			lastSegment = segment;
+		cv.notify_all();
+	}
+
+	// Queues a segment that is still being downloaded, its data follows through appendSegment
+	// and the decoder may read it before it is complete. Starts over if the segment exists already,
+	// which fails once the decoder has started reading it.
+	bool beginSegment(int segment, bool last = false)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+
+		if (activeStream.index == segment)
+			return false;
 
-		swapReady = true;
-		done = last;
+		PRINT_DEBUG_VSS("begin segment " << segment);
+		pendingSegments[segment] = std::make_shared<VideoTileStream::segment>();
+		if (last)
+			lastSegment = segment;
 		cv.notify_all();
+		return true;
 	}
 
-	~VideoTileStream()
+	// Appends downloaded data to a segment started by beginSegment, size is its final size if known
+	bool appendSegment(int segment, const char* data, size_t len, uint64_t size = 0)
 	{
-		
+		std::lock_guard<std::mutex> l(mtx);
+
+		auto seg = find(segment);
+		if (!seg || seg->complete)
+			return false;
+
+		seg->size = std::max<int64_t>(seg->size, size);
+		seg->append(data, len);
+		seg->size = std::max<int64_t>(seg->size, seg->received);
+		cv.notify_all();
+		return true;
 	}
 
-	int read(char* buf, int buf_size) override
+	// Marks a segment as completely received. What has not arrived until now is missing for good.
+	void endSegment(int segment)
 	{
-		auto ret = activeStream->read(buf, buf_size);
-		if (ret == 0 && swap())
-			ret = activeStream->read(buf, buf_size);
-		//PRINT_DEBUG_VSS("read " << ret);
-		return ret;
+		std::lock_guard<std::mutex> l(mtx);
+
+		auto seg = find(segment);
+		if (!seg)
+			return;
+
+		PRINT_DEBUG_VSS("end segment " << segment);
+		seg->complete = true;
+		seg->size = seg->received;
+		cv.notify_all();
 	}
 
-	int64_t seek(int64_t offset, int whence) override
+	// Replaces a queued segment, e.g. by a higher quality version of it.
+	// Fails while the segment is still being received or once the decoder has started reading it.
+	bool replaceSegment(int segment, std::string data)
 	{
-		offset -= swappedSize;
-		
-		if (whence == 0x10000)
+		std::lock_guard<std::mutex> l(mtx);
+
+		auto it = pendingSegments.find(segment);
+		if (it == pendingSegments.end() || !it->second->complete)
+			return false;
+
+		PRINT_DEBUG_VSS("replace segment " << segment);
+		it->second = std::make_shared<VideoTileStream::segment>(std::move(data));
+		return true;
+	}
+
+	// true if the segment has been queued and the decoder has not started reading it
+	bool isPending(int segment) const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return pendingSegments.find(segment) != pendingSegments.end();
+	}
+
+	// Seconds of video queued for the decoder without a gap: the unread part of the active
+	// segment and the received part of the following ones
+	double bufferedDuration(double segmentDuration) const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+
+		auto received = [](const segment& seg) { return seg.size ? seg.received / (double)seg.size : 0.0; };
+
+		auto& active = *activeStream.seg;
+		double duration = active.size ? activeStream.available() / (double)active.size * segmentDuration : 0.0;
+		if (!active.complete)
+			return duration;
+
+		for (int i = nextSegment; i <= lastSegment; i++)
 		{
-			return activeStream->size + swappedSize;
+			auto it = pendingSegments.find(i);
+			if (it == pendingSegments.end())
+				break;
+			duration += received(*it->second) * segmentDuration;
+			if (!it->second->complete)
+				break;
 		}
+		return duration;
+	}
 
-		return activeStream->seek(offset, whence);
+	~VideoTileStream()
+	{
+		
 	}
 
-	bool swap()
+	// blocks while the data to read is still being downloaded
+	int read(char* buf, int buf_size) override
 	{
+		std::unique_lock<std::mutex> lock(mtx);
+
+		while (true)
 		{
-			std::unique_lock<std::mutex> lock(mtx);
-			cv.wait(lock, [=] { return swapReady || done; });
+			cv.wait(lock, [this] { return activeStream.available() > 0 || activeStream.seg->complete; });
+			if (activeStream.available() > 0)
+				break;
+			if (!swap(lock))
+				return 0;
 		}
 
-		if (done && !swapReady)
-			return false;
+		auto ret = activeStream.read(buf, buf_size);
+		//PRINT_DEBUG_VSS("read " << ret);
+		return ret;
+	}
 
+	int64_t seek(int64_t offset, int whence) override
+	{
 		std::lock_guard<std::mutex> l(mtx);
-		swapReady = false;
 
-		if (activeStream == &ss1 && ss2.good())
-		{
-			PRINT_DEBUG_VSS("swap to s2");
-			swappedSize += ss1.size;
-			activeStream = &ss2;
-			return true;
-		}
-		if (activeStream == &ss2 && ss1.good())
+		// AVSEEK_SIZE: the size as far as it is known, up to the end of the active segment
+		if (whence == 0x10000)
 		{
-			PRINT_DEBUG_VSS("swap to s1");
-			swappedSize += ss2.size;
-			activeStream = &ss1;
-			return true;
+			return activeStream.seg->size + swappedSize;
 		}
-		return false;
+
+		// positions of the stream count from its start, the active segment's from its own
+		if (whence == SEEK_SET)
+			offset -= swappedSize;
+
+		auto pos = activeStream.seek(offset, whence);
+		return pos < 0 ? pos : pos + swappedSize;
 	}
 
 	int getQualityAtTime(double timestamp) const
 	{
+		std::lock_guard<std::mutex> l(mtx);
 		return std::prev(qualityLevelAtTimestampMap.upper_bound(timestamp))->second;
 	}
 
 	void addQuality(double timestamp, int quality)
 	{
+		std::lock_guard<std::mutex> l(mtx);
 		qualityLevelAtTimestampMap[timestamp] = quality;
 	}
 
 private:
-	struct stream
+	struct segment
 	{
-		std::istringstream s;
+		// a buffer is filled up to its capacity and then followed by a new one, so written data never moves
+		std::vector<std::shared_ptr<std::string>> buffers;
+		int64_t received;
 		int64_t size;
+		bool complete;
 
-		stream() : size(0) {}
+		segment() : received(0), size(0), complete(false) {}
 
-		stream(const std::string& str)
+		segment(std::string data) : received(0), size(0), complete(true)
 		{
-			init(str);
+			add(std::move(data));
 		}
 
-		int read(char* buf, int buf_size)
+		// takes over data as a buffer of its own
+		void add(std::string data)
 		{
-			s.read(buf, buf_size);
-			return s.gcount();
+			received += data.size();
+			size = std::max(size, received);
+			buffers.push_back(std::make_shared<std::string>(std::move(data)));
 		}
 
-		int64_t seek(int64_t offset, int whence)
+		void append(const char* data, size_t len)
 		{
-			if (!s.good())
-				s.clear();
+			if (buffers.empty() || buffers.back()->capacity() - buffers.back()->size() < len)
+			{
+				// room for the rest of the segment if its size is known
+				int64_t minBufferSize = 64 * 1024;
+				auto buffer = std::make_shared<std::string>();
+				buffer->reserve(std::max({ (int64_t)len, size - received, minBufferSize }));
+				buffers.push_back(buffer);
+			}
+			buffers.back()->append(data, len);
+			received += len;
+		}
+	};
 
-			s.seekg(offset, whence);
-			return s.tellg();
+	// read position in a segment, buffer is the one holding pos or an earlier one
+	struct stream
+	{
+		int index;
+		std::shared_ptr<segment> seg;
+		int64_t pos;
+		size_t buffer;
+		int64_t bufferStart;
+
+		stream() : index(-1), seg(std::make_shared<segment>()), pos(0), buffer(0), bufferStart(0) {}
+
+		stream(int index, const std::shared_ptr<segment>& seg)
+			: index(index), seg(seg), pos(0), buffer(0), bufferStart(0)
+		{
 		}
 
-		void append(const std::string& str)
+		int64_t available() const
 		{
-			if (size > 0 && good())
-			{
-				std::string concat;
-				concat.resize(size);
-				s.read(&concat[0], size);
-				concat += str;
-				s = std::istringstream(concat);
-				size = concat.size();
-			}
-			else
-				init(str);
+			return std::max<int64_t>(0, seg->received - pos);
 		}
 
-		bool good()
+		int read(char* buf, int buf_size)
 		{
-			return s.good();
+			int n = std::min<int64_t>(buf_size, available());
+			for (int done = 0; done < n;)
+			{
+				while (pos - bufferStart >= (int64_t)seg->buffers[buffer]->size())
+					bufferStart += seg->buffers[buffer++]->size();
+
+				auto& b = *seg->buffers[buffer];
+				int k = std::min<int64_t>(n - done, b.size() - (pos - bufferStart));
+				memcpy(buf + done, b.data() + (pos - bufferStart), k);
+				done += k;
+				pos += k;
+			}
+			return n;
 		}
 
-	private:
-		void init(const std::string& str)
+		int64_t seek(int64_t offset, int whence)
 		{
-			PRINT_DEBUG_VSS("Stream::init");
+			int64_t target = whence == SEEK_SET ? offset : whence == SEEK_CUR ? pos + offset : seg->size + offset;
+			if (target < 0 || target > seg->size)
+				return -1;
 
-			size = str.size();
-			s = std::istringstream(str);
+			// read finds the buffer from the current one onwards
+			if (target < bufferStart)
+			{
+				buffer = 0;
+				bufferStart = 0;
+			}
+			pos = target;
+			return pos;
 		}
 	};
 
+	// segment currently received into, the active one or a queued one
+	std::shared_ptr<segment> find(int index) const
+	{
+		if (activeStream.index == index)
+			return activeStream.seg;
+		auto it = pendingSegments.find(index);
+		return it != pendingSegments.end() ? it->second : nullptr;
+	}
+
+	// continue with the next segment once the active one is read, waits until it has been queued
+	bool swap(std::unique_lock<std::mutex>& lock)
+	{
+		cv.wait(lock, [this] { return pendingSegments.find(nextSegment) != pendingSegments.end() || nextSegment > lastSegment; });
+
+		auto it = pendingSegments.find(nextSegment);
+		if (it == pendingSegments.end())
+			return false;
+
+		PRINT_DEBUG_VSS("swap to segment " << nextSegment);
+		swappedSize += activeStream.seg->size;
+		activeStream = stream(nextSegment, it->second);
+		pendingSegments.erase(it);
+		nextSegment++;
+		return true;
+	}
+
 	int64_t swappedSize;
-	stream* activeStream;
-	stream ss1, ss2;
+	stream activeStream;
+	std::map<int, std::shared_ptr<segment>> pendingSegments;
+	int nextSegment;
+	int lastSegment;
 	mutable std::mutex mtx;
 	std::condition_variable cv;
-	bool swapReady = false;
-	bool done = false;
 	DASH::SRD srd;
 	std::map<double, int> qualityLevelAtTimestampMap;
 };
@@ -0,0 +1,322 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Projects the viewport sample grid onto the tiles of an equirectangular
+	tiling for a batch of head rotations. Samples are stored as arrays of
+	unit vectors and rotated several at a time (AVX2, SSE2 or plain C++),
+	tiles are found arithmetically on uniform SRD grids. Samples that come
+	too close to a tile border to be decided that way are passed to the
+	scalar reference projection, so results match it exactly.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VIEWPORT_PROJECTION_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VIEWPORT_PROJECTION_SSE2
+#endif
+
+#include "Quaternion.hpp"
+
+class ViewportProjection
+{
+public:
+	// tile covered by viewport sample number sample when the head is rotated by rotation
+	typedef std::function<int(const IMT::Quaternion& rotation, int sample)> SampleToTile;
+	// right border -> bottom border -> tile index, as built by AdaptionUnit
+	typedef std::map<double, std::map<double, int>> TileMapping;
+
+	// samples are normalized viewport coordinates (x, y members), the viewport
+	// spans 2*maxHDist x 2*maxVDist on the plane at distance 1
+	template<typename Coordinate>
+	ViewportProjection(const Coordinate* samples, int numSamples, double maxHDist, double maxVDist,
+		const TileMapping& tileMapping, const SampleToTile& reference)
+		: numSamples(numSamples), reference(reference)
+	{
+		int padded = (numSamples + Simd::width - 1) / Simd::width * Simd::width;
+		sampleX.assign(padded, 1);
+		sampleY.assign(padded, 0);
+		sampleZ.assign(padded, 0);
+
+		for (int i = 0; i < numSamples; i++)
+		{
+			IMT::VectorCartesian v(1, (samples[i].x - 0.5) * (2 * maxHDist), (0.5 - samples[i].y) * (2 * maxVDist));
+			v /= v.Norm();
+			sampleX[i] = v.GetX();
+			sampleY[i] = v.GetY();
+			sampleZ[i] = v.GetZ();
+		}
+
+		uniform = buildGrid(tileMapping);
+	}
+
+	ViewportProjection(const ViewportProjection&) = delete;
+	ViewportProjection& operator=(const ViewportProjection&) = delete;
+
+	// tiles[r * numSamples + s] receives the tile of sample s for rotations[r].
+	// Safe to call from several threads.
+	void project(const IMT::Quaternion* rotations, size_t numRotations, int* tiles) const
+	{
+		for (size_t r = 0; r < numRotations; r++)
+		{
+			int* out = tiles + r * numSamples;
+
+			if (!uniform)
+			{
+				for (int s = 0; s < numSamples; s++)
+					out[s] = reference(rotations[r], s);
+				continue;
+			}
+
+			double m[9];
+			rotationMatrix(rotations[r], m);
+
+			for (int s = 0; s < numSamples; s += Simd::width)
+			{
+				double column[Simd::width], row[Simd::width], margin[Simd::width];
+				projectBlock<Simd>(m, s, column, row, margin);
+
+				for (int l = 0; l < Simd::width && s + l < numSamples; l++)
+				{
+					double fraction = column[l] - std::floor(column[l]);
+					double columnMargin = std::min(fraction, 1 - fraction) / columns;
+
+					if (margin[l] < EPSILON || columnMargin < EPSILON)
+					{
+						out[s + l] = reference(rotations[r], s + l);
+						continue;
+					}
+
+					// first column whose right border is not left of the sample
+					int c = std::min(columns - 1, std::max(0, (int)std::ceil(column[l]) - 1));
+					out[s + l] = grid[c * rows + (int)row[l]];
+				}
+			}
+		}
+	}
+
+	int samples() const
+	{
+		return numSamples;
+	}
+
+	// false if the tiling is no uniform grid, every sample then takes the reference path
+	bool isUniform() const
+	{
+		return uniform;
+	}
+
+	static const char* instructionSet()
+	{
+		return Simd::name();
+	}
+
+private:
+	// samples closer than this to a tile border (in normalized coordinates) use the reference path
+	static constexpr double EPSILON = 1e-6;
+	static constexpr double PI = 3.141592653589793238462643383279502884;
+
+	int numSamples;
+	SampleToTile reference;
+	std::vector<double> sampleX;
+	std::vector<double> sampleY;
+	std::vector<double> sampleZ;
+
+	bool uniform;
+	int columns;
+	int rows;
+	std::vector<int> grid;
+	// cos(PI * bottom border) of every row but the last
+	std::vector<double> rowThreshold;
+
+	bool buildGrid(const TileMapping& tileMapping)
+	{
+		if (tileMapping.empty())
+			return false;
+
+		columns = tileMapping.size();
+		rows = tileMapping.begin()->second.size();
+		grid.assign(columns * rows, 0);
+
+		int c = 0;
+		for (auto& col : tileMapping)
+		{
+			if (col.second.size() != (size_t)rows || std::abs(col.first - (c + 1) / (double)columns) > 1e-12)
+				return false;
+
+			int r = 0;
+			for (auto& tile : col.second)
+			{
+				if (std::abs(tile.first - (r + 1) / (double)rows) > 1e-12)
+					return false;
+				grid[c * rows + r++] = tile.second;
+			}
+			c++;
+		}
+
+		auto& rowBorders = tileMapping.begin()->second;
+		for (auto it = rowBorders.begin(); std::next(it) != rowBorders.end(); it++)
+			rowThreshold.push_back(std::cos(PI * it->first));
+
+		return true;
+	}
+
+	static void rotationMatrix(const IMT::Quaternion& q, double* m)
+	{
+		double w = q.GetW(), x = q.GetV().GetX(), y = q.GetV().GetY(), z = q.GetV().GetZ();
+		// dividing by the squared norm rotates like a normalized quaternion
+		double s = 2 / (w * w + x * x + y * y + z * z);
+
+		double xx = x * x * s, yy = y * y * s, zz = z * z * s;
+		double xy = x * y * s, xz = x * z * s, yz = y * z * s;
+		double wx = w * x * s, wy = w * y * s, wz = w * z * s;
+
+		m[0] = 1 - (yy + zz); m[1] = xy - wz;        m[2] = xz + wy;
+		m[3] = xy + wz;       m[4] = 1 - (xx + zz);  m[5] = yz - wx;
+		m[6] = xz - wy;       m[7] = yz + wx;        m[8] = 1 - (xx + yy);
+	}
+
+	// Rotates samples [s, s + V::width) by m. column receives the equirectangular x
+	// coordinate in units of tile columns, row the tile row and margin the distance
+	// from the nearest row border, or from a pole where the column is not defined.
+	template<typename V>
+	void projectBlock(const double* m, int s, double* column, double* row, double* margin) const
+	{
+		typedef typename V::type T;
+
+		T x = V::load(&sampleX[s]);
+		T y = V::load(&sampleY[s]);
+		T z = V::load(&sampleZ[s]);
+
+		T rx = V::add(V::add(V::mul(V::set(m[0]), x), V::mul(V::set(m[1]), y)), V::mul(V::set(m[2]), z));
+		T ry = V::add(V::add(V::mul(V::set(m[3]), x), V::mul(V::set(m[4]), y)), V::mul(V::set(m[5]), z));
+		T rz = V::add(V::add(V::mul(V::set(m[6]), x), V::mul(V::set(m[7]), y)), V::mul(V::set(m[8]), z));
+
+		// a sample lies below row border r if its z is below cos(PI * border)
+		T r = V::set(0);
+		T distance = V::max(V::abs(rx), V::abs(ry));
+		for (double threshold : rowThreshold)
+		{
+			T d = V::sub(rz, V::set(threshold));
+			r = V::add(r, V::select(V::less(d, V::set(0)), V::set(1), V::set(0)));
+			distance = V::min(distance, V::abs(d));
+		}
+
+		// same mapping as fromViewportCoordToEquirectCoord
+		T f = V::add(V::set(0.75), V::mul(atan2<V>(ry, rx), V::set(1 / (2 * PI))));
+		f = V::select(V::less(f, V::set(1)), f, V::sub(f, V::set(1)));
+		T c = V::mul(V::sub(V::set(1), f), V::set(columns));
+
+		V::store(column, c);
+		V::store(row, r);
+		V::store(margin, distance);
+	}
+
+	// atan2 with the rational approximation of the Cephes library
+	template<typename V>
+	static typename V::type atan2(typename V::type y, typename V::type x)
+	{
+		typedef typename V::type T;
+
+		T ax = V::abs(x), ay = V::abs(y);
+		T t = V::div(V::min(ax, ay), V::max(V::max(ax, ay), V::set(1e-300)));
+
+		// atan(t) = PI/4 + atan((t - 1) / (t + 1))
+		auto reduced = V::less(V::set(0.66), t);
+		t = V::select(reduced, V::div(V::sub(t, V::set(1)), V::add(t, V::set(1))), t);
+
+		T t2 = V::mul(t, t);
+		T p = V::set(-8.750608600031904122785e-1);
+		p = V::add(V::mul(p, t2), V::set(-1.615753718733365076637e1));
+		p = V::add(V::mul(p, t2), V::set(-7.500855792314704667340e1));
+		p = V::add(V::mul(p, t2), V::set(-1.228866684490136173410e2));
+		p = V::add(V::mul(p, t2), V::set(-6.485021904942025371773e1));
+		T q = V::add(t2, V::set(2.485846490142306297962e1));
+		q = V::add(V::mul(q, t2), V::set(1.650270098316988542046e2));
+		q = V::add(V::mul(q, t2), V::set(4.328810604912902668951e2));
+		q = V::add(V::mul(q, t2), V::set(4.853903996359136964868e2));
+		q = V::add(V::mul(q, t2), V::set(1.945506571482613964425e2));
+
+		T a = V::add(t, V::div(V::mul(V::mul(t, t2), p), q));
+		a = V::add(a, V::select(reduced, V::set(PI / 4), V::set(0)));
+		a = V::select(V::less(ax, ay), V::sub(V::set(PI / 2), a), a);
+		a = V::select(V::less(x, V::set(0)), V::sub(V::set(PI), a), a);
+		return V::select(V::less(y, V::set(0)), V::sub(V::set(0), a), a);
+	}
+
+	struct Scalar
+	{
+		typedef double type;
+		static const int width = 1;
+		static const char* name() { return "scalar"; }
+
+		static type set(double v) { return v; }
+		static type load(const double* p) { return *p; }
+		static void store(double* p, type v) { *p = v; }
+		static type add(type a, type b) { return a + b; }
+		static type sub(type a, type b) { return a - b; }
+		static type mul(type a, type b) { return a * b; }
+		static type div(type a, type b) { return a / b; }
+		static type min(type a, type b) { return a < b ? a : b; }
+		static type max(type a, type b) { return a > b ? a : b; }
+		static type abs(type a) { return std::abs(a); }
+		static bool less(type a, type b) { return a < b; }
+		static type select(bool mask, type a, type b) { return mask ? a : b; }
+	};
+
+#if defined(VIEWPORT_PROJECTION_AVX2)
+	struct Avx2
+	{
+		typedef __m256d type;
+		static const int width = 4;
+		static const char* name() { return "AVX2"; }
+
+		static type set(double v) { return _mm256_set1_pd(v); }
+		static type load(const double* p) { return _mm256_loadu_pd(p); }
+		static void store(double* p, type v) { _mm256_storeu_pd(p, v); }
+		static type add(type a, type b) { return _mm256_add_pd(a, b); }
+		static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+		static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+		static type div(type a, type b) { return _mm256_div_pd(a, b); }
+		static type min(type a, type b) { return _mm256_min_pd(a, b); }
+		static type max(type a, type b) { return _mm256_max_pd(a, b); }
+		static type abs(type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+		static type less(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+		static type select(type mask, type a, type b) { return _mm256_blendv_pd(b, a, mask); }
+	};
+	typedef Avx2 Simd;
+#elif defined(VIEWPORT_PROJECTION_SSE2)
+	struct Sse2
+	{
+		typedef __m128d type;
+		static const int width = 2;
+		static const char* name() { return "SSE2"; }
+
+		static type set(double v) { return _mm_set1_pd(v); }
+		static type load(const double* p) { return _mm_loadu_pd(p); }
+		static void store(double* p, type v) { _mm_storeu_pd(p, v); }
+		static type add(type a, type b) { return _mm_add_pd(a, b); }
+		static type sub(type a, type b) { return _mm_sub_pd(a, b); }
+		static type mul(type a, type b) { return _mm_mul_pd(a, b); }
+		static type div(type a, type b) { return _mm_div_pd(a, b); }
+		static type min(type a, type b) { return _mm_min_pd(a, b); }
+		static type max(type a, type b) { return _mm_max_pd(a, b); }
+		static type abs(type a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+		static type less(type a, type b) { return _mm_cmplt_pd(a, b); }
+		static type select(type mask, type a, type b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+	};
+	typedef Sse2 Simd;
+#else
+	typedef Scalar Simd;
+#endif
+};
@@ -86,6 +86,8 @@ typedef int socket_t;
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <atomic>
+#include <vector>
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 #include <openssl/ssl.h>
@@ -100,6 +102,7 @@ typedef int socket_t;
 */
 #define CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND 5
 #define CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND 0
+#define CPPHTTPLIB_RECV_BUFSIZ 16384
 
 namespace httplib
 {
@@ -127,7 +130,11 @@ namespace httplib
 
 	typedef std::multimap<std::string, std::string>                Params;
 	typedef std::smatch                                            Match;
-	typedef std::function<void(uint64_t current, uint64_t total)> Progress;
+	// return false to abort the transfer
+	typedef std::function<bool(uint64_t current, uint64_t total)> Progress;
+	// takes the body in pieces as it arrives instead of Response::body, total is 0 if unknown
+	// return false to abort the transfer
+	typedef std::function<bool(const char* data, size_t data_length, uint64_t offset, uint64_t total)> ContentReceiver;
 
 	struct MultipartFile {
 		std::string filename;
@@ -148,7 +155,8 @@ namespace httplib
 		MultipartFiles files;
 		Match          matches;
 
-		Progress       progress;
+		Progress        progress;
+		ContentReceiver content_receiver;
 
 		bool has_header(const char* key) const;
 		std::string get_header_value(const char* key) const;
@@ -310,6 +318,19 @@ namespace httplib
 		
 		bool proxyServer = false;
 
+		// Keep connections to host:port open after a response and reuse them
+		// for later requests. Plain sockets only: an SSLClient always opens a
+		// new connection per request, whatever this is set to.
+		bool keepAlive = false;
+		size_t maxIdleConnections = 8;
+
+		struct ConnectionStats {
+			size_t handshakes;
+			size_t reuses;
+			size_t resolutions;
+		};
+		ConnectionStats connection_stats() const;
+
 	protected:
 		bool process_request(Stream& strm, Request& req, Response& res, bool& connection_close);
 
@@ -320,10 +341,25 @@ namespace httplib
 
 	private:
 		socket_t create_client_socket() const;
+		socket_t acquire_connection(bool& reused);
+		void release_connection(socket_t sock);
 		bool read_response_line(Stream& strm, Response& res);
 		void write_request(Stream& strm, Request& req);
 
 		virtual bool read_and_close_socket(socket_t sock, Request& req, Response& res);
+		// pooled connections are written through a plain SocketStream
+		virtual bool can_keep_alive() const { return keepAlive; }
+
+		mutable std::mutex               connection_mutex_;
+		std::vector<socket_t>            idle_sockets_;
+		mutable struct sockaddr_storage  cached_addr_;
+		mutable socklen_t                cached_addrlen_ = 0;
+		mutable int                      cached_family_ = 0;
+		mutable int                      cached_socktype_ = 0;
+		mutable int                      cached_protocol_ = 0;
+		mutable std::atomic<size_t>      handshakes_{ 0 };
+		std::atomic<size_t>              reuses_{ 0 };
+		mutable std::atomic<size_t>      resolutions_{ 0 };
 	};
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
@@ -371,6 +407,7 @@ namespace httplib
 
 	private:
 		virtual bool read_and_close_socket(socket_t sock, Request& req, Response& res);
+		virtual bool can_keep_alive() const { return false; }
 
 		SSL_CTX* ctx_;
 		std::mutex ctx_mutex_;
@@ -603,6 +640,10 @@ namespace httplib
 				// Make 'reuse address' option available
 				int yes = 1;
 				setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+				// no MSG_NOSIGNAL on macOS
+				setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (char*)&yes, sizeof(yes));
+#endif
 
 				// bind or connect
 				if (fn(sock, *rp)) {
@@ -833,8 +874,36 @@ namespace httplib
 			return true;
 		}
 
-		inline bool read_content_with_length(Stream& strm, std::string& out, size_t len, Progress progress)
+		// hands a received piece to the receiver if there is one, else appends it to out
+		inline bool store_content(std::string& out, const char* data, size_t n, uint64_t offset, uint64_t total, const ContentReceiver& receiver)
 		{
+			if (receiver) {
+				return receiver(data, n, offset, total);
+			}
+			out.append(data, n);
+			return true;
+		}
+
+		inline bool read_content_with_length(Stream& strm, std::string& out, size_t len, Progress progress, const ContentReceiver& receiver = nullptr)
+		{
+			if (receiver) {
+				char buf[CPPHTTPLIB_RECV_BUFSIZ];
+				size_t r = 0;
+				while (r < len) {
+					auto n = strm.read(buf, std::min(len - r, sizeof(buf)));
+					if (n <= 0 || !receiver(buf, n, r, len)) {
+						return false;
+					}
+
+					r += n;
+
+					if (progress && !progress(r, len)) {
+						return false;
+					}
+				}
+				return true;
+			}
+
 			out.assign(len, 0);
 			size_t r = 0;
 			while (r < len) {
@@ -845,31 +914,35 @@ namespace httplib
 
 				r += n;
 
-				if (progress) {
-					progress(r, len);
+				if (progress && !progress(r, len)) {
+					return false;
 				}
 			}
 			return true;
 		}
 
-		inline bool read_content_without_length(Stream& strm, std::string& out)
+		inline bool read_content_without_length(Stream& strm, std::string& out, const ContentReceiver& receiver = nullptr)
 		{
+			char buf[CPPHTTPLIB_RECV_BUFSIZ];
+			uint64_t r = 0;
 			for (;;) {
-				char byte;
-				auto n = strm.read(&byte, 1);
+				auto n = strm.read(buf, sizeof(buf));
 				if (n < 0) {
 					return false;
 				}
 				else if (n == 0) {
 					return true;
 				}
-				out += byte;
+				if (!store_content(out, buf, n, r, 0, receiver)) {
+					return false;
+				}
+				r += n;
 			}
 
 			return true;
 		}
 
-		inline bool read_content_chunked(Stream& strm, std::string& out)
+		inline bool read_content_chunked(Stream& strm, std::string& out, const ContentReceiver& receiver = nullptr)
 		{
 			const auto bufsiz = 16;
 			char buf[bufsiz];
@@ -881,6 +954,7 @@ namespace httplib
 			}
 
 			auto chunk_len = std::stoi(reader.ptr(), 0, 16);
+			uint64_t r = 0;
 
 			while (chunk_len > 0) {
 				std::string chunk;
@@ -896,7 +970,10 @@ namespace httplib
 					break;
 				}
 
-				out += chunk;
+				if (!store_content(out, chunk.data(), chunk.size(), r, 0, receiver)) {
+					return false;
+				}
+				r += chunk.size();
 
 				if (!reader.getline()) {
 					return false;
@@ -915,21 +992,23 @@ namespace httplib
 		}
 
 		template <typename T>
-		bool read_content(Stream& strm, T& x, Progress progress = Progress())
+		bool read_content(Stream& strm, T& x, Progress progress = Progress(), const ContentReceiver& receiver = nullptr)
 		{
 			auto len = get_header_value_int(x.headers, "Content-Length", 0);
 
-			if (len) {
-				return read_content_with_length(strm, x.body, len, progress);
+			// an explicit "Content-Length: 0" must not fall through to reading until EOF,
+			// a kept-alive connection would never deliver it
+			if (len || x.headers.find("Content-Length") != x.headers.end()) {
+				return read_content_with_length(strm, x.body, len, progress, receiver);
 			}
 			else {
 				const auto& encoding = get_header_value(x.headers, "Transfer-Encoding", "");
 
 				if (!strcasecmp(encoding, "chunked")) {
-					return read_content_chunked(strm, x.body);
+					return read_content_chunked(strm, x.body, receiver);
 				}
 				else {
-					return read_content_without_length(strm, x.body);
+					return read_content_without_length(strm, x.body, receiver);
 				}
 			}
 
@@ -1471,7 +1550,12 @@ namespace httplib
 
 	inline int SocketStream::write(const char* ptr, size_t size)
 	{
+		// a pooled connection the peer has closed must fail the write, not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+		return send(sock_, ptr, size, MSG_NOSIGNAL);
+#else
 		return send(sock_, ptr, size, 0);
+#endif
 	}
 
 	inline int SocketStream::write(const char* ptr)
@@ -1932,6 +2016,10 @@ namespace httplib
 
 	inline Client::~Client()
 	{
+		std::lock_guard<std::mutex> l(connection_mutex_);
+		for (auto sock : idle_sockets_) {
+			detail::close_socket(sock);
+		}
 	}
 
 	inline bool Client::is_valid() const
@@ -1939,24 +2027,106 @@ namespace httplib
 		return true;
 	}
 
+	inline Client::ConnectionStats Client::connection_stats() const
+	{
+		return { handshakes_, reuses_, resolutions_ };
+	}
+
 	inline socket_t Client::create_client_socket() const
 	{
-		return detail::create_socket(host_.c_str(), port_,
-			[=](socket_t sock, struct addrinfo& ai) -> bool {
+		// the caller closes the socket on failure
+		auto connect_socket = [=](socket_t sock, struct addrinfo& ai) -> bool {
 			detail::set_nonblocking(sock, true);
 
 			auto ret = connect(sock, ai.ai_addr, ai.ai_addrlen);
 			if (ret < 0) {
 				if (detail::is_connection_error() ||
 					!detail::wait_until_socket_is_ready(sock, timeout_sec_, 0)) {
-					detail::close_socket(sock);
 					return false;
 				}
 			}
 
 			detail::set_nonblocking(sock, false);
 			return true;
+		};
+
+		// connect to the address resolved by an earlier request
+		struct addrinfo cached;
+		struct sockaddr_storage cached_addr;
+		memset(&cached, 0, sizeof(cached));
+		{
+			std::lock_guard<std::mutex> l(connection_mutex_);
+			cached.ai_family = cached_family_;
+			cached.ai_socktype = cached_socktype_;
+			cached.ai_protocol = cached_protocol_;
+			cached.ai_addrlen = cached_addrlen_;
+			cached_addr = cached_addr_;
+		}
+		if (cached.ai_addrlen) {
+			cached.ai_addr = (struct sockaddr*)&cached_addr;
+			auto sock = socket(cached.ai_family, cached.ai_socktype, cached.ai_protocol);
+			if (sock != INVALID_SOCKET) {
+				if (connect_socket(sock, cached)) {
+					handshakes_++;
+					return sock;
+				}
+				detail::close_socket(sock);
+			}
+		}
+
+		resolutions_++;
+		auto sock = detail::create_socket(host_.c_str(), port_,
+			[&](socket_t sock, struct addrinfo& ai) -> bool {
+			if (!connect_socket(sock, ai)) {
+				return false;
+			}
+
+			std::lock_guard<std::mutex> l(connection_mutex_);
+			memcpy(&cached_addr_, ai.ai_addr, ai.ai_addrlen);
+			cached_addrlen_ = ai.ai_addrlen;
+			cached_family_ = ai.ai_family;
+			cached_socktype_ = ai.ai_socktype;
+			cached_protocol_ = ai.ai_protocol;
+			return true;
 		});
+		if (sock != INVALID_SOCKET) {
+			handshakes_++;
+		}
+		return sock;
+	}
+
+	inline socket_t Client::acquire_connection(bool& reused)
+	{
+		{
+			std::lock_guard<std::mutex> l(connection_mutex_);
+			while (!idle_sockets_.empty()) {
+				auto sock = idle_sockets_.back();
+				idle_sockets_.pop_back();
+
+				// an idle connection has nothing to read unless the peer closed it
+				if (detail::select_read(sock, 0, 0) == 0) {
+					reused = true;
+					reuses_++;
+					return sock;
+				}
+				detail::close_socket(sock);
+			}
+		}
+
+		reused = false;
+		return create_client_socket();
+	}
+
+	inline void Client::release_connection(socket_t sock)
+	{
+		{
+			std::lock_guard<std::mutex> l(connection_mutex_);
+			if (idle_sockets_.size() < maxIdleConnections) {
+				idle_sockets_.push_back(sock);
+				return;
+			}
+		}
+		detail::close_socket(sock);
 	}
 
 	inline bool Client::read_response_line(Stream& strm, Response& res)
@@ -1987,12 +2157,44 @@ namespace httplib
 			return false;
 		}
 
-		auto sock = create_client_socket();
-		if (sock == INVALID_SOCKET) {
-			return false;
+		if (!can_keep_alive()) {
+			auto sock = create_client_socket();
+			if (sock == INVALID_SOCKET) {
+				return false;
+			}
+
+			return read_and_close_socket(sock, req, res);
 		}
 
-		return read_and_close_socket(sock, req, res);
+		// The proxy may close an idle connection at any time. That only shows when
+		// no response line arrives, so such a request is retried once on a new connection.
+		for (int attempt = 0; attempt < 2; attempt++) {
+			auto reused = false;
+			auto sock = acquire_connection(reused);
+			if (sock == INVALID_SOCKET) {
+				return false;
+			}
+
+			SocketStream strm(sock);
+			auto connection_close = false;
+			if (process_request(strm, req, res, connection_close)) {
+				if (connection_close) {
+					detail::close_socket(sock);
+				}
+				else {
+					release_connection(sock);
+				}
+				return true;
+			}
+
+			detail::close_socket(sock);
+			if (!reused || res.status != -1) {
+				return false;
+			}
+			res = Response();
+		}
+
+		return false;
 	}
 
 	inline void Client::write_request(Stream& strm, Request& req)
@@ -2008,6 +2210,8 @@ namespace httplib
 		//std::cout << strm.
 
 		// Headers
+		req.headers.erase("Host");
+		req.headers.erase("Connection");
 		req.set_header("Host", host_and_port_.c_str());
 
 		if (!req.has_header("Accept")) {
@@ -2018,10 +2222,7 @@ namespace httplib
 			req.set_header("User-Agent", "cpp-httplib/0.2");
 		}
 
-		// TODO: Support KeepAlive connection
-		// if (!req.has_header("Connection")) {
-		req.set_header("Connection", "close");
-		// }
+		req.set_header("Connection", keepAlive ? "keep-alive" : "close");
 
 		if (!req.body.empty()) {
 			if (!req.has_header("Content-Type")) {
@@ -2060,9 +2261,17 @@ namespace httplib
 			connection_close = true;
 		}
 
+		// without length or chunked encoding the body ends when the server closes the connection
+		if (req.method != "HEAD" && !res.has_header("Content-Length") &&
+			strcasecmp(res.get_header_value("Transfer-Encoding").c_str(), "chunked")) {
+			connection_close = true;
+		}
+
 		// Body
 		if (req.method != "HEAD") {
-			if (!detail::read_content(strm, res, req.progress)) {
+			// a receiver only takes successful responses, error pages still end up in the body
+			auto receiver = res.status >= 200 && res.status < 300 ? req.content_receiver : nullptr;
+			if (!detail::read_content(strm, res, req.progress, receiver)) {
 				return false;
 			}
 
@@ -39,6 +39,7 @@
 #include <sstream>
 #include <memory>
 #include <chrono>
+#include <limits>
 #include <stdlib.h> // For exit()
 
 // This must come after we include <GL/gl.h> so its pointer types are defined.
@@ -46,6 +47,9 @@
 #include <osvr/RenderKit/RenderKitGraphicsTransforms.h>
 
 //Internal Includes
+// replaces operator new in builds with COUNT_ALLOCATIONS
+#define ALLOCATION_COUNTER_MAIN
+#include "AllocationCounter.hpp"
 #include "Mesh.hpp"
 #include "ShaderTexture.hpp"
 #include "ConfigParser.hpp"
@@ -56,7 +60,11 @@
 #include "VideoTileStream.hpp"
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
+#include "TileFetcher.hpp"
+#include "InitSegmentCache.hpp"
+#include "PlaybackEvents.hpp"
 #include "HeadTrace.hpp"
+#include "PoseHistory.hpp"
 
 using namespace IMT;
 Config* Config::_instance = 0;
@@ -65,19 +73,25 @@ Config* Config::_instance = 0;
 static httplib::Client* httpClient;
 static DASH::MPD* mpd;
 static AdaptionUnit* au;
+static TileFetcher* tileFetcher;
+static InitSegmentCache* initCache;
 static HeadTrace* headTrace;
 static std::shared_ptr<ShaderTexture> sampleShader(nullptr);
+static std::shared_ptr<ShaderTextureVideo> videoShader(nullptr);
 static std::shared_ptr<Mesh> roomMesh(nullptr);
 static VideoTileStream* segmentStreams{ nullptr };
 //static std::shared_ptr<LogWriter> logWriter(nullptr);
 //static std::shared_ptr<PublisherLogMQ> publisherLogMQ(nullptr);
 static int numTiles = 0;
 constexpr std::chrono::system_clock::time_point zero(std::chrono::system_clock::duration::zero());
+// degrees the head may turn before tiles it brings into view are uploaded, with tile upload
+constexpr double TILE_UPLOAD_MARGIN = 10.0;
 static std::chrono::system_clock::time_point global_startDisplayTime(zero);
 static size_t lastDisplayedFrame(0);
 static size_t lastNbDroppedFrame(0);
 static bool started(false);
-static CircularBuffer<std::pair<long long, Quaternion>> headRotations;
+static PoseHistory<> headRotations;
+static PlaybackEvents playbackEvents;
 static long long startTimeEpochMs;
 static bool firstSegmentDownloaded = false;
 
@@ -255,16 +269,29 @@ void DrawWorld(
 
 		static bool leftEye = true;
 		if (leftEye)
-			headRotations.push({ TIME_NOW_EPOCH_MS - startTimeEpochMs, Quaternion(q.w(), q.z(), q.x(), -q.y()) });
+		{
+			headRotations.push(TIME_NOW_EPOCH_MS - startTimeEpochMs, Quaternion(q.w(), q.z(), q.x(), -q.y()));
+			// only waited for until the history is full, publishing takes a lock
+			if (headRotations.count() <= headRotations.capacity())
+				playbackEvents.publishHeadSamples(headRotations.count());
+		}
 		leftEye = !leftEye;
 
 		if (firstSegmentDownloaded)
 		{
+			if (Config::instance()->tileUpload)
+			{
+				static std::vector<char> visibleTiles;
+				au->visibleTiles(Quaternion(q.w(), q.z(), q.x(), -q.y()), TILE_UPLOAD_MARGIN, visibleTiles);
+				videoShader->setVisibleTiles(visibleTiles);
+			}
+
 			// Draw a cube with a 5-meter radius as the room we are floating in.
 			auto frameInfo = roomMesh->Draw(projectionGL, viewGL, sampleShader, std::move(deadlineTP));
 			//au->printTileVisibility(Quaternion(q.w(), q.z(), q.x(), -q.y()));
 
 			lastDisplayedFrame = frameInfo.m_frameDisplayId;
+			playbackEvents.publishFrame(lastDisplayedFrame);
 			lastNbDroppedFrame += frameInfo.m_nbDroppedFrame;
 
 			if (frameInfo.m_last)
@@ -273,50 +300,169 @@ void DrawWorld(
 	}
 }
 
+// Seconds of video that can be played without further downloads: the decoded frames
+// and what every tile stream holds ahead of the decoder
+double playoutBuffer(double segmentDuration, double frameRate)
+{
+	double queued = std::numeric_limits<double>::max();
+	for (int t = 0; t < numTiles; t++)
+		queued = std::min(queued, segmentStreams[t].bufferedDuration(segmentDuration));
+	return videoShader->bufferedFrames() / frameRate + queued;
+}
+
+// Downloads tiles of a buffered segment again in higher quality if fresher head data
+// predicts them more visible. A segment is upgraded at most once, when it is the next
+// to be displayed and the decoder has not started reading it. Other downloads go first:
+// the upgrade waits for them, up to maxWait seconds and only while the segment is not displayed.
+// Returns false if there was nothing to upgrade.
+bool upgradeBufferedSegment(int segment, double segmentDuration, double frameRate, double maxWait)
+{
+	static int lastUpgradedSegment = 0;
+
+	double lead = segment * segmentDuration - playbackEvents.displayedFrame() / frameRate;
+	if (segment <= lastUpgradedSegment || lead > segmentDuration)
+		return false;
+	if (!tileFetcher->waitIdle(std::chrono::milliseconds((long long)(std::min(lead, maxWait) * 1000))))
+		return false;
+
+	lead = segment * segmentDuration - playbackEvents.displayedFrame() / frameRate;
+	if (lead <= 0)
+		return false;
+	lastUpgradedSegment = segment;
+
+	std::vector<int> bufferedQuality(numTiles);
+	for (int t = 0; t < numTiles; t++)
+	{
+		if (!segmentStreams[t].isPending(segment))
+			return false;
+		bufferedQuality[t] = segmentStreams[t].getQualityAtTime(segment * segmentDuration);
+	}
+
+	PoseHistory<>::Snapshot poses;
+	headRotations.snapshot(poses);
+	au->setBufferLevel(lead);
+	auto& upgrades = au->startUpgrade(poses, segment, bufferedQuality);
+	tileFetcher->fetch(upgrades, [&](const AdaptionUnit::TileDownload& tile)
+	{
+		// a good buffered segment is only replaced by a complete one
+		if (tile.res && tile.res->status == 200 && segmentStreams[tile.tile].replaceSegment(segment, std::move(tile.res->body)))
+			segmentStreams[tile.tile].addQuality(segment * segmentDuration, tile.quality);
+	});
+	au->stopAdaption();
+
+	return !upgrades.empty();
+}
+
 void querySegmentThread()
 {
-	while (headRotations.size() < 1)
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	playbackEvents.waitForHeadSamples(1);
+
+	// fast start: the first segment is fetched in the lowest quality, all tiles concurrently
+	// together with their init segments unless those are cached
+	au->initAdaption(headRotations.latest());
+	std::vector<std::string> initSegments(numTiles), firstSegments(numTiles);
+	std::vector<TileFetcher::Task> initFetches;
+	for (int t = 0; t < numTiles; t++)
+	{
+		auto initUrl = mpd->getInitUrl(t);
+		if (initCache->get(initUrl, initSegments[t]))
+			continue;
+		initFetches.push_back([t, initUrl, &initSegments]
+		{
+			// only a complete init segment is kept, later runs would start from a broken one
+			auto res = httpClient->Get(initUrl.c_str());
+			if (res && res->status == 200)
+			{
+				initSegments[t] = std::move(res->body);
+				initCache->put(initUrl, initSegments[t]);
+			}
+		});
+	}
+	std::vector<int> firstQuality(numTiles);
+	tileFetcher->fetch(au->lowestQualityRequests(0), [&](const AdaptionUnit::TileDownload& fs)
+	{
+		if (fs.res && fs.res->status == 200)
+			firstSegments[fs.tile] = std::move(fs.res->body);
+		firstQuality[fs.tile] = fs.quality;
+	}, initFetches);
 
-	au->initAdaption(headRotations[0]);
-	for (int i = 0; i < numTiles; i++)
+	for (int t = 0; t < numTiles; t++)
 	{
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
-		auto fsRes = au->download(i, 0);
-		segmentStreams[i].init(mpd->period.adaptationSets[i].srd, initRes->body, fsRes->body);
-		segmentStreams[i].addQuality(0, au->getCurrentTileQuality().at(i));
+		// without its first segment the tile starts with the second one
+		segmentStreams[t].init(mpd->period.adaptationSets[t].srd, std::move(initSegments[t]), std::move(firstSegments[t]));
+		segmentStreams[t].addQuality(0, firstQuality[t]);
 	}
 	au->stopAdaption();
 
-	sampleShader = std::make_shared<ShaderTextureVideo>(segmentStreams, numTiles, -1, 150, 0);
+	videoShader = std::make_shared<ShaderTextureVideo>(segmentStreams, numTiles, -1, 150, 0);
+	sampleShader = videoShader;
 	firstSegmentDownloaded = true;
 
-	while (headRotations.size() < headRotations.capacity())
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	playbackEvents.waitForHeadSamples(headRotations.capacity());
 
 	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
+	int bufferSegments = Config::instance()->bufferSegments;
+	bool upgradeTiles = Config::instance()->upgradeTiles;
+	PoseHistory<>::Snapshot poses;
 
 	for (int i = 1; i < numSegments; i++)
 	{
 		int firstSegmentFrame = i * segmentFrames;
 
-		while (firstSegmentFrame - segmentFrames > lastDisplayedFrame)
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		// keep up to bufferSegments segments ahead of playback,
+		// meanwhile spend spare bandwidth on the buffered segment displayed next
+		double roomFrame = firstSegmentFrame - bufferSegments * segmentFrames;
+		size_t displayedFrame;
+		while ((displayedFrame = playbackEvents.displayedFrame()) < roomFrame)
+		{
+			int nextSegment = displayedFrame / segmentFrames + 1;
+			// the upgrade waits for running downloads, but not beyond the moment the buffer has room
+			if (upgradeTiles && nextSegment < i && upgradeBufferedSegment(nextSegment, segmentDuration, frameRate, (roomFrame - displayedFrame) / frameRate))
+				continue;
+
+			// sleep until there is room in the buffer or the following segment is next
+			double wakeFrame = upgradeTiles && nextSegment + 1 < i ? std::min(roomFrame, nextSegment * segmentFrames) : roomFrame;
+			playbackEvents.waitForFrame((size_t)std::ceil(wakeFrame));
+		}
+
+		// the previous segment may still be downloading, so its hidden tiles compete with
+		// the visible tiles of this one; older segments have to be complete
+		tileFetcher->wait(i - 2);
 
-		auto tileDownloadOrder = au->startAdaption(headRotations, i);
-		assert(tileDownloadOrder.size() == numTiles);
+		au->setBufferLevel((firstSegmentFrame - (double)playbackEvents.displayedFrame()) / frameRate);
+		au->setPlayoutBuffer(playoutBuffer(segmentDuration, frameRate));
+		headRotations.snapshot(poses);
+		auto& tileRequests = au->startAdaption(poses, i);
+		assert(tileRequests.size() == numTiles);
+
+		// tiles are streamed into the decoder's queue as they arrive
+		std::vector<AdaptionUnit::TileSink> sinks(numTiles);
 		for (int t = 0; t < numTiles; t++)
 		{
-			int tileIndex = tileDownloadOrder[t];
-			auto res = au->download(tileIndex, i);
-			segmentStreams[tileIndex].addSegment(res->body, i == numSegments - 1);
-			segmentStreams[tileIndex].addQuality(i * segmentDuration, au->getCurrentTileQuality().at(tileIndex));
+			auto& stream = segmentStreams[t];
+			sinks[t].begin = [&stream, i, numSegments, segmentDuration](int quality)
+			{
+				if (!stream.beginSegment(i, i == numSegments - 1))
+					return false;
+				stream.addQuality(i * segmentDuration, quality);
+				return true;
+			};
+			sinks[t].receive = [&stream, i](const char* data, size_t len, uint64_t offset, uint64_t total)
+			{
+				return stream.appendSegment(i, data, len, total);
+			};
 		}
+		tileFetcher->submit(tileRequests, [](const AdaptionUnit::TileDownload& tile)
+		{
+			segmentStreams[tile.tile].endSegment(tile.segment);
+		}, &sinks);
 		au->stopAdaption();
 	}
+	tileFetcher->wait(numSegments - 1);
+	au->storeBandwidthEstimate();
 }
 
 #ifdef _WIN32
@@ -338,6 +484,8 @@ int main(int argc, char* argv[])
 	{
 		httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 		httpClient->proxyServer = true;
+		httpClient->keepAlive = config->keepAlive;
+		httpClient->maxIdleConnections = std::max(1, config->parallelDownloads);
 
 		auto res = httpClient->Get(config->mpdUri.c_str());
 		if (!res || res->status != 200)
@@ -346,7 +494,9 @@ int main(int argc, char* argv[])
 			return -1;
 		}
 		mpd = new DASH::MPD(res->body);
+		initCache = new InitSegmentCache(config->initCache, config->mpdUri, res->body);
 		au = new AdaptionUnit(mpd, httpClient);
+		tileFetcher = new TileFetcher(au, config->parallelDownloads);
 
 		auto srd = mpd->period.adaptationSets[0].srd;
 		numTiles = srd.th * srd.tv;
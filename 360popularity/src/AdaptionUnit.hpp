@@ -12,6 +12,8 @@ TU Darmstadt
 #include <algorithm>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
 #include "mpd.h"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
@@ -36,7 +38,10 @@ class AdaptionUnit
 public:
 	struct NormalizedCoordinate { double x, y; };
 
-	AdaptionUnit(const DASH::MPD* mpd) : mpd(mpd)
+	AdaptionUnit(const DASH::MPD* mpd)
+		: mpd(mpd)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -56,14 +61,16 @@ public:
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
 	}
 
 	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
@@ -73,6 +80,8 @@ private:
 	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
 	std::map<int, int> tileQuality;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
 
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
@@ -178,7 +178,7 @@ namespace DASH
 
 		double segmentDuration(int adaptionSet = 0, int representation = 0) const
 		{
-			auto segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
+			auto& segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
 			return segmentList.duration / (double)segmentList.timescale;
 		}
 
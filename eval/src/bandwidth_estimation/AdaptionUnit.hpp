@@ -15,6 +15,9 @@
 #include <algorithm>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
+#include "BandwidthEstimator.hpp"
 #include "mpd.h"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
@@ -46,6 +49,8 @@ public:
 		: mpd(mpd), httpClient(httpClient)
 		, bytesDownloaded(0), durationDownload(0)
 		, bandwidthEstimate(0)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -65,6 +70,9 @@ public:
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
 	}
 
 	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
@@ -82,6 +90,18 @@ public:
 			return 2000000;
 	}
 
+	// false if every download since the last adaption was a cache hit
+	bool hasBandwidthSample() const
+	{
+		return durationDownload != 0;
+	}
+
+	// estimators fed with a sample for every cache miss
+	void setEstimators(const std::vector<BandwidthEstimator*>& estimators)
+	{
+		this->estimators = estimators;
+	}
+
 	void startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
 	{
 		bandwidthEstimate = 4200000;
@@ -177,6 +197,8 @@ public:
 		{
 			durationDownload += duration;
 			bytesDownloaded += res->body.size();
+			for (auto estimator : estimators)
+				estimator->addSample({ timer, timer + duration, res->body.size(), 1 });
 		}
 		totalBytesDownloaded += res->body.size();
 
@@ -235,8 +257,7 @@ public:
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		for (int i = 0; i < 16; i++)
 			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
@@ -266,7 +287,10 @@ private:
 	size_t bytesDownloaded;
 	int durationDownload;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
 	size_t totalBytesDownloaded = 0;
+	std::vector<BandwidthEstimator*> estimators;
 	
 	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
 	{
@@ -295,8 +319,7 @@ private:
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			visibilityTable.accumulate(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -330,8 +353,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				visibilityTable.accumulate(rot, tileVisibilityMap);
 			}
 		}
 
@@ -38,6 +38,28 @@ int numTiles;
 AdaptionUnit* au;
 
 const std::string netTrace = "TMobile-LTE-driving";
+const std::vector<std::string> estimatorTypes = { "segment", "ewma", "harmonic", "percentile" };
+
+// error of the estimates made before each segment against the throughput measured while downloading it
+struct EstimatorError
+{
+	double relativeError = 0;
+	double overestimate = 0;
+	int overestimated = 0;
+	int segments = 0;
+
+	void add(double estimate, double measured)
+	{
+		relativeError += std::abs(estimate - measured) / measured;
+		// an overestimate selects qualities that take longer than a segment to download, i.e. stalls
+		if (estimate > measured)
+		{
+			overestimate += estimate / measured - 1;
+			overestimated++;
+		}
+		segments++;
+	}
+};
 
 #ifdef _WIN32
 typedef std::wstring pathType;
@@ -164,15 +186,41 @@ int main(int argc, char* argv[])
 	std::cout << "Trace set." << std::endl;
 
 	std::ofstream csv(netTrace + ".csv");
-	csv << "Iteration,Time,Mbps\n";
+	// Mbps is the measured throughput, the estimator columns hold the estimate for the next segment
+	csv << "Iteration,Time,Mbps";
+	for (auto& type : estimatorTypes)
+		csv << "," << type;
+	csv << "\n";
+
+	// estimates stored by an earlier run would give the first session a warm start
+	for (auto& type : estimatorTypes)
+		fs::remove(type + ".bw");
+	std::vector<EstimatorError> errors(estimatorTypes.size());
 
 	Config::instance()->popularity = true;
 	Config::instance()->viewportPrediction = false;
 	for (int i = 0; i < 30; i++)
 	{
+		// every iteration is a session starting from the estimate stored by the previous one
+		std::vector<std::unique_ptr<BandwidthEstimator>> estimators;
+		std::vector<BandwidthEstimator*> estimatorPtrs;
+		for (auto& type : estimatorTypes)
+		{
+			estimators.push_back(BandwidthEstimator::create(type, BandwidthEstimator::load(type + ".bw", 2000000)));
+			estimatorPtrs.push_back(estimators.back().get());
+		}
+		au->setEstimators(estimatorPtrs);
+
+		std::vector<double> estimates;
+		for (auto& estimator : estimators)
+			estimates.push_back(estimator->estimate());
+
 		httpClient->Get("/tracereset");
 		auto startTime = TIME_NOW_EPOCH_MS;
-		csv << i << "," << 0 << "," << 2000000 * 8 / 1000000.0 << "\n";
+		csv << i << "," << 0 << "," << 2000000 * 8 / 1000000.0;
+		for (double estimate : estimates)
+			csv << "," << estimate * 8 / 1000000.0;
+		csv << "\n";
 		downloadTrace(traces[0], [&](int segment)
 		{
 			std::cout << "\rPopular " << segment + 1 << "/" << numSegments << std::flush;
@@ -181,13 +229,41 @@ int main(int argc, char* argv[])
 			int sleepDurMs = (segment + 1) * 1500 - ts;
 			if (sleepDurMs > 0)
 				std::this_thread::sleep_for(std::chrono::milliseconds(sleepDurMs));
-			csv << i << "," << ts << "," << au->bwEstimate() * 8 / 1000000.0 << "\n";
+
+			double measured = au->bwEstimate();
+			for (size_t e = 0; e < estimators.size(); e++)
+			{
+				if (au->hasBandwidthSample())
+					errors[e].add(estimates[e], measured);
+				estimates[e] = estimators[e]->estimate();
+			}
+
+			csv << i << "," << ts << "," << measured * 8 / 1000000.0;
+			for (double estimate : estimates)
+				csv << "," << estimate * 8 / 1000000.0;
+			csv << "\n";
 			au->resetTotalBytesDownloaded();
 		});
 		std::cout << std::endl;
+
+		for (size_t e = 0; e < estimators.size(); e++)
+			BandwidthEstimator::store(estimatorTypes[e] + ".bw", estimators[e]->estimate());
+		au->setEstimators({});
 	}
 
 	csv.close();
 
+	std::ofstream summary(netTrace + "_estimators.csv");
+	summary << "Estimator,MeanRelativeError,Overestimated,MeanOverestimate\n";
+	for (size_t e = 0; e < errors.size(); e++)
+	{
+		auto& error = errors[e];
+		int n = std::max(1, error.segments);
+		summary << estimatorTypes[e] << "," << error.relativeError / n << "," << error.overestimated / (double)n << ","
+			<< error.overestimate / std::max(1, error.overestimated) << "\n";
+		std::cout << estimatorTypes[e] << ": mean relative error " << error.relativeError / n
+			<< ", overestimated " << error.overestimated << "/" << error.segments << " segments" << std::endl;
+	}
+
 	return 0;
 }
@@ -0,0 +1,176 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Latency of the render thread's calls into the decoded frame queue, the
+	lock-free FrameQueue against the former mutex based Buffer. A producer
+	thread adds frames like the decoder, the consumer polls like the render
+	thread and times every poll. Run once with a producer that is faster than
+	the consumer (full queue) and once with a slow one (mostly empty queue).
+
+	Usage: ./360eval [frames] [capacity] [decodeMicroseconds]
+*/
+
+// Standard includes
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+
+//Internal Includes
+#include "Buffer.hpp"
+#include "FrameQueue.hpp"
+
+using namespace IMT;
+
+struct Frame
+{
+	size_t index;
+};
+
+struct Result
+{
+	std::vector<double> pollNs;
+	double seconds;
+	size_t received;
+	bool ordered;
+};
+
+// busy waits, so the producer competes for the CPU like a decoder does
+void work(long long microseconds)
+{
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+	while (std::chrono::steady_clock::now() < end);
+}
+
+template <class Poll>
+void consume(Result& result, const Poll& poll)
+{
+	auto start = std::chrono::steady_clock::now();
+	while (true)
+	{
+		auto before = std::chrono::steady_clock::now();
+		int status = poll();
+		result.pollNs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count());
+		if (status < 0)
+			break;
+		// nothing to display yet, a render thread would draw the previous frame meanwhile
+		if (status == 0)
+			work(1);
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result runBuffer(size_t frames, size_t capacity, long long decodeUs)
+{
+	Result result{ {}, 0, 0, true };
+	result.pollNs.reserve(frames * (decodeUs + 2));
+	Buffer<Frame> buffer(capacity);
+	buffer.SetTotal(frames);
+
+	std::thread producer([&]
+	{
+		for (size_t i = 0; ; i++)
+		{
+			work(decodeUs);
+			auto frame = std::make_shared<Frame>();
+			frame->index = i;
+			if (!buffer.Add(std::move(frame)))
+				return;
+		}
+	});
+
+	// as VideoReader did per displayed frame: check for the end, look at the front, take it
+	consume(result, [&]
+	{
+		if (buffer.IsAllDones())
+			return -1;
+		auto frame = buffer.Get();
+		if (frame == nullptr)
+			return 0;
+		result.ordered &= frame->index == result.received++;
+		buffer.Pop();
+		return 1;
+	});
+
+	producer.join();
+	return result;
+}
+
+Result runFrameQueue(size_t frames, size_t capacity, long long decodeUs)
+{
+	Result result{ {}, 0, 0, true };
+	result.pollNs.reserve(frames * (decodeUs + 2));
+	FrameQueue<Frame> queue(capacity);
+
+	std::thread producer([&]
+	{
+		for (size_t i = 0; i < frames; i++)
+		{
+			work(decodeUs);
+			auto frame = std::make_shared<Frame>();
+			frame->index = i;
+			if (!queue.Push(std::move(frame)))
+				return;
+		}
+		queue.Close();
+	});
+
+	std::shared_ptr<Frame> frame;
+	consume(result, [&]
+	{
+		if (queue.IsDone())
+			return -1;
+		auto next = queue.Front();
+		if (next == nullptr)
+			return 0;
+		result.ordered &= next->index == result.received++;
+		queue.Pop(frame);
+		return 1;
+	});
+
+	producer.join();
+	return result;
+}
+
+double percentile(std::vector<double>& v, double p)
+{
+	auto nth = v.begin() + (size_t)(p * (v.size() - 1));
+	std::nth_element(v.begin(), nth, v.end());
+	return *nth;
+}
+
+void print(const std::string& name, Result result, size_t frames)
+{
+	auto& ns = result.pollNs;
+	std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(0)
+		<< std::setw(10) << ns.size()
+		<< std::setw(10) << percentile(ns, 0.5)
+		<< std::setw(10) << percentile(ns, 0.99)
+		<< std::setw(10) << percentile(ns, 0.999)
+		<< std::setw(12) << *std::max_element(ns.begin(), ns.end())
+		<< std::setw(12) << result.received / result.seconds
+		<< "  " << (result.received == frames && result.ordered ? "ok" : "FRAMES LOST OR REORDERED") << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	size_t frames = argc > 1 ? atoi(argv[1]) : 200000;
+	size_t capacity = argc > 2 ? atoi(argv[2]) : 150;
+	long long slowDecodeUs = argc > 3 ? atoi(argv[3]) : 20;
+
+	for (long long decodeUs : { 0LL, slowDecodeUs })
+	{
+		std::cout << frames << " frames, capacity " << capacity << ", " << decodeUs << " us per decoded frame" << std::endl;
+		std::cout << std::left << std::setw(12) << "queue" << std::right << std::setw(10) << "polls" << std::setw(10) << "p50 ns"
+			<< std::setw(10) << "p99 ns" << std::setw(10) << "p99.9 ns" << std::setw(12) << "max ns" << std::setw(12) << "frames/s" << std::endl;
+
+		print("Buffer", runBuffer(frames, capacity, decodeUs), frames);
+		print("FrameQueue", runFrameQueue(frames, capacity, decodeUs), frames);
+		std::cout << std::endl;
+	}
+}
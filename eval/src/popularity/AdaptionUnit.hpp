@@ -14,6 +14,8 @@
 #include <map>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
 #include "mpd.h"
 #include "httplib.h"
 
@@ -41,6 +43,8 @@ public:
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
 		: mpd(mpd), httpClient(httpClient)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -60,6 +64,9 @@ public:
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
 	}
 
 
@@ -126,8 +133,7 @@ public:
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
@@ -190,6 +196,8 @@ private:
 	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
 	std::map<int, int> tileQuality;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
 	int cacheHits = 0;
 	int totalFilesDownloaded = 0;
 	size_t cacheHitBytesDownloaded = 0;
@@ -222,8 +230,7 @@ private:
 		if (headRotations.size() == 1)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			visibilityTable.accumulate(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -257,8 +264,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				visibilityTable.accumulate(rot, tileVisibilityMap);
 			}
 		}
 
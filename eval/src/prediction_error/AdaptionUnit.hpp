@@ -15,6 +15,8 @@
 #include <algorithm>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
 #include "mpd.h"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
@@ -46,6 +48,8 @@ public:
 		: mpd(mpd), httpClient(httpClient)
 		, bytesDownloaded(0), durationDownload(0)
 		, bandwidthEstimate(0)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -65,6 +69,9 @@ public:
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
 	}
 
 	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
@@ -233,8 +240,7 @@ public:
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		for (int i = 0; i < 16; i++)
 			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
@@ -264,6 +270,8 @@ private:
 	size_t bytesDownloaded;
 	int durationDownload;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
 	int cacheHits = 0;
 	int totalFilesDownloaded = 0;
 	size_t cacheHitBytesDownloaded = 0;
@@ -296,8 +304,7 @@ private:
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			visibilityTable.accumulate(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -331,8 +338,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				visibilityTable.accumulate(rot, tileVisibilityMap);
 			}
 		}
 
@@ -1,6 +1,10 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Mean orthodromic error of the head rotation predictors per trace: the
+	Euler angle regression of AdaptionUnit and the extrapolation on the
+	rotation group of HeadMotionPredictor, undamped and damped.
 */
 
 // Internal Includes
@@ -26,6 +30,7 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "HeadMotionPredictor.hpp"
 
 using namespace IMT;
 Config* Config::_instance = 0;
@@ -66,13 +71,21 @@ int main(int argc, char* argv[])
 
 	double timeframes[4] = { 0.1, 0.25, 0.5, 1.0 };
 	double predictiontimes[4] = { 0.5, 1.0, 1.5, 2.0 };
-	std::cout << "Prediction Time (s),Timeframe (s),Error (Deg.)" << std::endl;
+	// angular velocity decay rates in 1/s, 0 extrapolates it unchanged
+	double dampings[3] = { 0.0, 1.0, 2.0 };
+	std::cout << "Prediction Time (s),Timeframe (s),Regression Error (Deg.)";
+	for (double damping : dampings)
+		std::cout << ",Quaternion Damping " << damping << " Error (Deg.)";
+	std::cout << std::endl;
 	for (int l = 0; l < 4; l++)
 	{
 		double predictionTime = predictiontimes[l];
 		for (int k = 0; k < 4; k++)
 		{
 			double predictionTimeframe = timeframes[k];
+			std::vector<HeadMotionPredictor> predictors;
+			for (double damping : dampings)
+				predictors.push_back(HeadMotionPredictor(predictionTimeframe * 1000, damping));
 			int j = 0;
 			// iterate all trace files in folder
 			for (auto& f : std::experimental::filesystem::directory_iterator(config->headtracePath))
@@ -93,6 +106,7 @@ int main(int argc, char* argv[])
 				double segmentFrames = segmentDuration * frameRate;
 
 				double errorAcc = 0;
+				std::vector<double> predictorErrorAcc(predictors.size(), 0.0);
 				int numPredictions = 0;
 
 				for (int i = 2; i < numSegments; i++)
@@ -111,10 +125,17 @@ int main(int argc, char* argv[])
 					auto predicted = au->predictHeadRotation(headRotations, when * 1000);
 					auto actual = headTrace->rotationForTimestampIt(when)->second;
 					errorAcc += Quaternion::OrthodromicDistance(actual, predicted);
+					for (size_t p = 0; p < predictors.size(); p++)
+						predictorErrorAcc[p] += Quaternion::OrthodromicDistance(actual, predictors[p].predict(headRotations, when * 1000));
 					numPredictions++;
 				}
 				if (std::isnormal(errorAcc / numPredictions * (180.0 / PI)))
-					std::cout << predictionTime << "," << predictionTimeframe << "," << errorAcc / numPredictions * (180.0 / PI) << std::endl;
+				{
+					std::cout << predictionTime << "," << predictionTimeframe << "," << errorAcc / numPredictions * (180.0 / PI);
+					for (double predictorError : predictorErrorAcc)
+						std::cout << "," << predictorError / numPredictions * (180.0 / PI);
+					std::cout << std::endl;
+				}
 			}
 		}
 	}
@@ -0,0 +1,146 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Result and run time of the multiple-choice knapsack QualitySolver. On small
+	random instances its result is compared with the optimum found by trying
+	every combination of qualities, then the time of a solve is measured for
+	the tile and quality counts of real videos. Costs are random bitrates, some
+	of them lowered as for cached representations.
+
+	Usage: ./360eval [instances] [tiles] [qualities]
+*/
+
+// Standard includes
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+
+//Internal Includes
+#include "QualitySolver.hpp"
+
+struct Instance
+{
+	int tiles;
+	int qualities;
+	std::vector<double> bitrate;
+	std::vector<double> cost;
+	std::vector<double> weight;
+	double budget;
+};
+
+Instance randomInstance(std::mt19937& rng, int tiles, int qualities)
+{
+	std::uniform_real_distribution<double> u(0, 1);
+	Instance in{ tiles, qualities, std::vector<double>(tiles * qualities), std::vector<double>(tiles * qualities), std::vector<double>(tiles), 0 };
+
+	double cheapest = 0, dearest = 0;
+	for (int t = 0; t < tiles; t++)
+	{
+		// quality 0 is the highest, each lower one about half the bitrate
+		double b = 100000 * (0.5 + u(rng));
+		for (int q = qualities - 1; q >= 0; q--)
+		{
+			in.bitrate[t * qualities + q] = b;
+			in.cost[t * qualities + q] = u(rng) < 0.15 ? b * 0.2 : b;
+			b *= 1.6 + u(rng);
+		}
+		// a third of the tiles is not visible
+		in.weight[t] = u(rng) < 0.33 ? 0 : u(rng);
+
+		auto begin = in.cost.begin() + t * qualities;
+		cheapest += in.weight[t] > 0 ? *std::min_element(begin, begin + qualities) : in.cost[t * qualities + qualities - 1];
+		dearest += *std::max_element(begin, begin + qualities);
+	}
+	in.budget = cheapest + u(rng) * (dearest - cheapest);
+	return in;
+}
+
+QualitySolver makeSolver(const Instance& in)
+{
+	QualitySolver solver(in.tiles, in.qualities, [&](int t, int q) { return in.bitrate[t * in.qualities + q]; });
+	solver.setCost([&](int t, int q) { return in.cost[t * in.qualities + q]; });
+	return solver;
+}
+
+// best value within the budget over all combinations, tiles of weight 0 stay in the lowest quality
+double bruteForce(const Instance& in, const QualitySolver& solver)
+{
+	std::vector<int> quality(in.tiles);
+	for (int t = 0; t < in.tiles; t++)
+		quality[t] = in.weight[t] > 0 ? 0 : in.qualities - 1;
+	double best = -1;
+	while (true)
+	{
+		double cost = 0;
+		for (int t = 0; t < in.tiles; t++)
+			cost += in.cost[t * in.qualities + quality[t]];
+		if (cost <= in.budget)
+			best = std::max(best, solver.value(in.weight, quality));
+
+		int t = 0;
+		for (; t < in.tiles; t++)
+		{
+			if (in.weight[t] <= 0)
+				continue;
+			if (++quality[t] < in.qualities)
+				break;
+			quality[t] = 0;
+		}
+		if (t == in.tiles)
+			return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int instances = argc > 1 ? atoi(argv[1]) : 2000;
+	int tiles = argc > 2 ? atoi(argv[2]) : 6;
+	int qualities = argc > 3 ? atoi(argv[3]) : 4;
+
+	std::mt19937 rng(42);
+	int optimal = 0, overBudget = 0;
+	double worst = 1, sum = 0;
+	for (int i = 0; i < instances; i++)
+	{
+		auto in = randomInstance(rng, tiles, qualities);
+		auto solver = makeSolver(in);
+		std::vector<int> quality(tiles);
+		double used = solver.solve(in.weight, in.budget, quality);
+		double value = solver.value(in.weight, quality);
+		double best = bruteForce(in, solver);
+
+		if (used > in.budget + 1e-6)
+			overBudget++;
+		double ratio = best > 0 ? value / best : 1;
+		if (ratio > 1 - 1e-9)
+			optimal++;
+		worst = std::min(worst, ratio);
+		sum += ratio;
+	}
+
+	std::cout << instances << " instances, " << tiles << " tiles, " << qualities << " qualities" << std::endl;
+	std::cout << std::fixed << std::setprecision(4)
+		<< "optimal " << 100.0 * optimal / instances << " %, mean " << sum / instances
+		<< " of the optimum, worst " << worst << ", over budget " << overBudget << std::endl << std::endl;
+
+	std::cout << "tiles  qualities  us per solve" << std::endl;
+	for (auto size : { std::make_pair(16, 3), std::make_pair(36, 4), std::make_pair(64, 5) })
+	{
+		auto in = randomInstance(rng, size.first, size.second);
+		auto solver = makeSolver(in);
+		std::vector<int> quality(size.first);
+		int runs = 10000;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < runs; r++)
+			solver.solve(in.weight, in.budget * (0.5 + (r % 10) / 10.0), quality);
+		double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+		std::cout << std::setw(5) << size.first << std::setw(11) << size.second << std::setprecision(2) << std::setw(14) << us << std::endl;
+	}
+
+	return 0;
+}
@@ -13,6 +13,8 @@
 #include <string>
 
 #include "Quaternion.hpp"
+#include "TileVisibilityTable.hpp"
+#include "ViewportProjection.hpp"
 #include "mpd.h"
 #include "httplib.h"
 
@@ -40,6 +42,8 @@ public:
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
 		: mpd(mpd), httpClient(httpClient)
+		, visibilityTable(mpd->period.adaptationSets.size(), SAMPLEPOINTS, [this](const Quaternion& rotation, int* tiles)
+			{ projection->project(&rotation, 1, tiles); })
 	{
 		auto srd = mpd->period.adaptationSets[0].srd;
 
@@ -59,14 +63,16 @@ public:
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projection.reset(new ViewportProjection(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist, normalizedCoordTileMapping,
+			[this](const Quaternion& rotation, int sample) { return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); }));
 	}
 
 	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		visibilityTable.accumulate(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
@@ -120,6 +126,8 @@ private:
 	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
 	std::map<int, int> tileQuality;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	std::unique_ptr<ViewportProjection> projection;
+	TileVisibilityTable visibilityTable;
 	int cacheHits = 0;
 	int totalFilesDownloaded = 0;
 	size_t cacheHitBytesDownloaded = 0;
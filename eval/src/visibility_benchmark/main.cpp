@@ -0,0 +1,128 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Throughput of the batched viewport projection against the scalar path of
+	AdaptionUnit, for several sample grid resolutions. Also checks that both
+	map every sample to the same tile.
+
+	Usage: ./360eval [columns] [rows] [rotations]
+*/
+
+// Standard includes
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <stdlib.h>
+
+//Internal Includes
+#include "Quaternion.hpp"
+#include "ViewportProjection.hpp"
+
+using namespace IMT;
+
+constexpr float PI = 3.141592653589793238462643383279502884L;
+
+static const double monocular_horizontal = 92.0;
+static const double monocular_vertical = 92.0;
+
+static const double maxHDist = 1.5 * std::tan(monocular_horizontal * PI / 180.0 / 2.0);
+static const double maxVDist = 1.5 * std::tan(monocular_vertical * PI / 180.0 / 2.0);
+
+struct NormalizedCoordinate { double x, y; };
+
+std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+
+// scalar path as in AdaptionUnit
+int mapCoordToTile(NormalizedCoordinate coord)
+{
+	return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+}
+
+NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
+{
+	double u = (viewportCoord.x - 0.5) * (2 * maxHDist);
+	double v = (0.5 - viewportCoord.y) * (2 * maxVDist);
+
+	VectorCartesian coordBefRot(1, u, v);
+	coordBefRot /= coordBefRot.Norm();
+
+	VectorSpherical pixel3dPolar = headRotation.Rotation(coordBefRot);
+
+	NormalizedCoordinate equirectCoord;
+	equirectCoord.x = 1.0 - std::fmod(0.75 + pixel3dPolar.GetTheta() / (2.0*PI), 1.0);
+	equirectCoord.y = pixel3dPolar.GetPhi() / PI;
+
+	return equirectCoord;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+	int columns = argc > 1 ? atoi(argv[1]) : 4;
+	int rows = argc > 2 ? atoi(argv[2]) : 4;
+	int numRotations = argc > 3 ? atoi(argv[3]) : 20000;
+
+	// uniform SRD tiling, tiles numbered row by row as in the MPD
+	for (int r = 0; r < rows; r++)
+		for (int c = 0; c < columns; c++)
+			normalizedCoordTileMapping[(c + 1) / (double)columns][(r + 1) / (double)rows] = r * columns + c;
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> yaw(-PI_L, PI_L), pitch(-PI_L / 2, PI_L / 2), roll(-PI_L / 4, PI_L / 4);
+	std::vector<Quaternion> rotations;
+	for (int i = 0; i < numRotations; i++)
+		rotations.push_back(Quaternion::FromEuler(yaw(rng), pitch(rng), roll(rng)));
+
+	std::cout << "tiling " << columns << "x" << rows << ", " << numRotations << " rotations, "
+		<< ViewportProjection::instructionSet() << std::endl;
+	std::cout << "SAMPLERES  scalar Msamples/s  batched Msamples/s  speedup  mismatches" << std::endl;
+
+	for (int sampleRes : { 8, 16, 32, 64 })
+	{
+		std::vector<NormalizedCoordinate> samplePoints;
+		for (int i = 0; i <= sampleRes; i++)
+			for (int j = 0; j <= sampleRes; j++)
+				samplePoints.push_back({ i * (1.0 / sampleRes), j * (1.0 / sampleRes) });
+		int numSamples = samplePoints.size();
+
+		auto reference = [&](const Quaternion& rotation, int sample)
+			{ return mapCoordToTile(fromViewportCoordToEquirectCoord(rotation, samplePoints[sample])); };
+		ViewportProjection projection(samplePoints.data(), numSamples, maxHDist, maxVDist, normalizedCoordTileMapping, reference);
+
+		std::vector<int> scalarTiles(rotations.size() * numSamples);
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < rotations.size(); r++)
+			for (int s = 0; s < numSamples; s++)
+				scalarTiles[r * numSamples + s] = reference(rotations[r], s);
+		double scalarMs = elapsedMs(start);
+
+		std::vector<int> batchedTiles(rotations.size() * numSamples);
+		start = std::chrono::steady_clock::now();
+		projection.project(rotations.data(), rotations.size(), batchedTiles.data());
+		double batchedMs = elapsedMs(start);
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < scalarTiles.size(); i++)
+			if (scalarTiles[i] != batchedTiles[i])
+				mismatches++;
+
+		double total = (double)rotations.size() * numSamples;
+		std::cout << std::setw(9) << sampleRes << std::fixed << std::setprecision(1)
+			<< std::setw(20) << total / scalarMs / 1000.0
+			<< std::setw(20) << total / batchedMs / 1000.0
+			<< std::setw(8) << scalarMs / batchedMs << "x"
+			<< std::setw(12) << mismatches << std::endl;
+	}
+
+	return 0;
+}